@@ -0,0 +1,35 @@
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+std::atomic<uint64_t> allocations(0);
+}
+
+uint64_t allocation_count()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void* pointer = std::malloc(size == 0 ? 1 : size))
+    return pointer;
+
+  throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+  std::free(pointer);
+}
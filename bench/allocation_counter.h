@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of calls to operator new since the program started.
+uint64_t allocation_count();
@@ -0,0 +1,88 @@
+#include "export_generator.h"
+
+#include <cmath>
+
+#include <boost/format.hpp>
+
+namespace
+{
+void append_binary(std::string& out, const std::string& name, const std::string& value)
+{
+  out += name;
+  out += '\n';
+  const uint64_t size = value.size();
+  for (int i = 0; i < 8; ++i)
+  {
+    out += static_cast<char>((size >> (8 * i)) & 0xff);
+  }
+  out += value;
+  out += '\n';
+}
+
+// Fields of a typical system service, besides cursor, timestamps, hostname and message.
+const char* const common_fields[] = {
+  "_BOOT_ID=5f1e2d3c4b5a69788796a5b4c3d2e1f0",
+  "PRIORITY=6",
+  "SYSLOG_FACILITY=3",
+  "SYSLOG_IDENTIFIER=example",
+  "_TRANSPORT=journal",
+  "_PID=1234",
+  "_UID=0",
+  "_GID=0",
+  "_COMM=example",
+  "_EXE=/usr/bin/example",
+  "_CMDLINE=/usr/bin/example --daemon --config /etc/example.conf",
+  "_CAP_EFFECTIVE=3fffffffff",
+  "_SELINUX_CONTEXT=system_u:system_r:init_t:s0",
+  "_SYSTEMD_CGROUP=/system.slice/example.service",
+  "_SYSTEMD_UNIT=example.service",
+  "_SYSTEMD_SLICE=system.slice",
+  "_SYSTEMD_INVOCATION_ID=0123456789abcdef0123456789abcdef",
+  "CODE_FILE=src/example/main.c",
+  "CODE_LINE=123",
+  "CODE_FUNC=handle_request",
+  "_MACHINE_ID=0123456789abcdef0123456789abcdef",
+  "_SOURCE_REALTIME_TIMESTAMP=1500000000000000",
+};
+
+const size_t fixed_fields = 5;
+const size_t common_field_count = sizeof(common_fields) / sizeof(common_fields[0]);
+}
+
+std::string generate_export(const export_generator_options& options)
+{
+  std::string out;
+  const std::string binary(options.binary_size, 'x');
+  const std::string message(options.message_size, 'm');
+  const size_t extra_fields = options.fields > fixed_fields + common_field_count ? options.fields - fixed_fields - common_field_count : 0;
+  const uint64_t start = 1500000000000000;
+
+  for (size_t i = 0; i < options.entries; ++i)
+  {
+    out += (boost::format("__CURSOR=s=0b3c9a1f;i=%1%;b=5f1e2d3c;m=%2%;t=%3%;x=1a2b3c4d\n") % i % (i * 7) % (start + i)).str();
+    out += (boost::format("__REALTIME_TIMESTAMP=%1%\n") % (start + i)).str();
+    out += (boost::format("__MONOTONIC_TIMESTAMP=%1%\n") % (i * 7)).str();
+    out += "_HOSTNAME=" + options.hostname + "\n";
+    out += "MESSAGE=" + message + "\n";
+
+    for (size_t f = 0; f < common_field_count && fixed_fields + f < options.fields; ++f)
+    {
+      out += common_fields[f];
+      out += '\n';
+    }
+
+    for (size_t f = 0; f < extra_fields; ++f)
+    {
+      out += (boost::format("EXTRA_FIELD_%1%=value %1%\n") % f).str();
+    }
+
+    if (std::floor((i + 1) * options.binary_ratio) > std::floor(i * options.binary_ratio))
+    {
+      append_binary(out, "COREDUMP", binary);
+    }
+
+    out += '\n';
+  }
+
+  return out;
+}
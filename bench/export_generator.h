@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+struct export_generator_options
+{
+  size_t entries = 100000;
+  // Number of fields per entry, at least the fields of a typical service.
+  size_t fields = 26;
+  size_t message_size = 80;
+  // Fraction of entries which carry an additional binary field.
+  double binary_ratio = 0.1;
+  size_t binary_size = 4096;
+  std::string hostname = "host.example.com";
+};
+
+// Generates entries in the journal export format, as sent by gatewayd.
+std::string generate_export(const export_generator_options& options);
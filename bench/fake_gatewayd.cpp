@@ -0,0 +1,191 @@
+#include "fake_gatewayd.h"
+
+#include <zlib.h>
+
+#include <stdexcept>
+
+#include <boost/algorithm/string/find.hpp>
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+
+namespace
+{
+std::string gzip(const std::string& data)
+{
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error("deflateInit2 failed");
+
+  std::string result(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&result[0]);
+  stream.avail_out = static_cast<uInt>(result.size());
+  const int ret = deflate(&stream, Z_FINISH);
+  result.resize(stream.total_out);
+  deflateEnd(&stream);
+
+  if (ret != Z_STREAM_END)
+    throw std::runtime_error("deflate failed");
+  return result;
+}
+
+const char cursor_prefix[] = "__CURSOR=";
+}
+
+fake_gatewayd::fake_gatewayd(boost::asio::io_service& io_service, std::string body, const fake_gatewayd_options& options)
+  : io_service(io_service)
+  , acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+  , options(options)
+  , body(std::move(body))
+{
+  if (options.gzip)
+    compressed_body = gzip(this->body);
+  index_entries();
+  accept();
+}
+
+unsigned short fake_gatewayd::port() const
+{
+  return acceptor.local_endpoint().port();
+}
+
+std::string fake_gatewayd::cursor(size_t index) const
+{
+  const size_t begin = entry_offsets[index] + sizeof(cursor_prefix) - 1;
+  return body.substr(begin, body.find('\n', begin) - begin);
+}
+
+void fake_gatewayd::index_entries()
+{
+  // Every generated entry starts with its cursor.
+  const std::string separator = std::string("\n\n") + cursor_prefix;
+  size_t offset = body.compare(0, sizeof(cursor_prefix) - 1, cursor_prefix) == 0 ? 0 : std::string::npos;
+  while (offset != std::string::npos)
+  {
+    entry_offsets.push_back(offset);
+    cursor_entries[cursor(entry_offsets.size() - 1)] = entry_offsets.size() - 1;
+
+    offset = body.find(separator, offset);
+    if (offset != std::string::npos)
+      offset += 2;
+  }
+  entry_offsets.push_back(body.size());
+}
+
+void fake_gatewayd::accept()
+{
+  auto c = std::make_shared<connection>(io_service);
+  acceptor.async_accept(c->socket, [this, c](const boost::system::error_code& ec) {
+    if (ec)
+      return;
+
+    connections.push_back(c);
+    read_request(c);
+    accept();
+  });
+}
+
+void fake_gatewayd::read_request(const std::shared_ptr<connection>& c)
+{
+  boost::asio::async_read_until(c->socket, c->request, "\r\n\r\n", boost::bind(&fake_gatewayd::handle_request, this, c, _1, _2));
+}
+
+void fake_gatewayd::handle_request(const std::shared_ptr<connection>& c, const boost::system::error_code& ec, size_t bytes_transferred)
+{
+  if (ec)
+    return;
+
+  const std::string request(boost::asio::buffer_cast<const char*>(c->request.data()), bytes_transferred);
+  c->request.consume(bytes_transferred);
+
+  const bool compress = options.gzip && boost::algorithm::ifind_first(request, "gzip");
+  const bool follow = request.find("&follow") != std::string::npos;
+
+  // "Range: entries=<cursor>[[:<skip>]:<count>]"
+  const size_t entry_count = entry_offsets.size() - 1;
+  size_t begin = 0;
+  size_t end = entry_count;
+  const size_t range = request.find("Range: entries=");
+  if (range != std::string::npos)
+  {
+    const size_t value = range + 15;
+    const std::string spec = request.substr(value, request.find('\r', value) - value);
+    const size_t colon = spec.find(':');
+    const auto entry = cursor_entries.find(spec.substr(0, colon));
+    if (entry != cursor_entries.end())
+      begin = entry->second;
+
+    if (colon != std::string::npos)
+    {
+      const size_t second = spec.find(':', colon + 1);
+      size_t count = std::stoul(spec.substr(second == std::string::npos ? colon + 1 : second + 1));
+      if (second != std::string::npos)
+        begin += std::stoul(spec.substr(colon + 1, second - colon - 1));
+      begin = std::min(begin, entry_count);
+      if (!follow)
+        end = std::min(begin + count, entry_count);
+    }
+  }
+
+  std::string range_content;
+  if (begin != 0 || end != entry_count)
+  {
+    range_content = body.substr(entry_offsets[begin], entry_offsets[end] - entry_offsets[begin]);
+    if (compress)
+      range_content = gzip(range_content);
+  }
+  const std::string& content = begin != 0 || end != entry_count ? range_content : compress ? compressed_body : body;
+
+  auto response = std::make_shared<std::string>();
+  bool end_response = false;
+  if (!follow)
+  {
+    *response = "HTTP/1.1 200 OK\r\nContent-Type: application/vnd.fdo.journal\r\n";
+    if (compress)
+      *response += "Content-Encoding: gzip\r\n";
+    *response += (boost::format("Content-Length: %1%\r\n\r\n") % content.size()).str();
+    *response += content;
+    end_response = true;
+  }
+  else if (!options.keep_alive)
+  {
+    *response = "HTTP/1.0 200 OK\r\nContent-Type: application/vnd.fdo.journal\r\n";
+    if (compress)
+      *response += "Content-Encoding: gzip\r\n";
+    *response += "\r\n";
+    *response += content;
+  }
+  else
+  {
+    *response = "HTTP/1.1 200 OK\r\nContent-Type: application/vnd.fdo.journal\r\nTransfer-Encoding: chunked\r\n";
+    if (compress)
+      *response += "Content-Encoding: gzip\r\n";
+    *response += "\r\n";
+
+    if (c->first_request)
+    {
+      // Split the body like a server flushing its output buffer.
+      const size_t chunk_size = 32 * 1024;
+      for (size_t pos = 0; pos < content.size(); pos += chunk_size)
+      {
+        const size_t size = std::min(chunk_size, content.size() - pos);
+        *response += (boost::format("%x\r\n") % size).str();
+        response->append(content, pos, size);
+        *response += "\r\n";
+      }
+      *response += "0\r\n\r\n";
+      end_response = true;
+    }
+  }
+
+  c->first_request = false;
+
+  boost::asio::async_write(c->socket, boost::asio::buffer(*response), [this, c, response, end_response](const boost::system::error_code& ec, size_t) {
+    if (!ec && end_response)
+      read_request(c);
+  });
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+struct fake_gatewayd_options
+{
+  // Compress the body with gzip if the request accepts it.
+  bool gzip = false;
+  // Send the body with chunked transfer encoding and end the response, so
+  // the reader has to send another request on the same connection.
+  bool keep_alive = false;
+};
+
+// Minimal stand-in for systemd-journal-gatewayd.
+//
+// Every connection receives the same pregenerated body after its request
+// header has been read, starting at the entry given by the Range header.
+// The connection is then kept open like a followed journal without new
+// entries. With keep_alive the first response ends after the body and
+// further requests are answered with an open response which never receives
+// data.
+//
+// Requests without follow receive the number of entries asked for by the
+// Range header with a Content-Length, and another request may be sent on
+// the same connection.
+class fake_gatewayd
+{
+  struct connection
+  {
+    boost::asio::ip::tcp::socket socket;
+    boost::asio::streambuf request;
+    bool first_request = true;
+
+    explicit connection(boost::asio::io_service& io_service)
+      : socket(io_service)
+    {
+    }
+  };
+
+  boost::asio::io_service& io_service;
+  boost::asio::ip::tcp::acceptor acceptor;
+  const fake_gatewayd_options options;
+  const std::string body;
+  std::string compressed_body;
+  // Offset of every entry in body, followed by the size of body.
+  std::vector<size_t> entry_offsets;
+  std::map<std::string, size_t> cursor_entries;
+  std::vector<std::shared_ptr<connection>> connections;
+
+  void index_entries();
+  void accept();
+  void read_request(const std::shared_ptr<connection>& c);
+  void handle_request(const std::shared_ptr<connection>& c, const boost::system::error_code& ec, size_t bytes_transferred);
+
+public:
+  fake_gatewayd(boost::asio::io_service& io_service, std::string body, const fake_gatewayd_options& options = fake_gatewayd_options());
+
+  // The port listened on at the loopback address.
+  unsigned short port() const;
+
+  // Cursor of the entry at index, which must exist.
+  std::string cursor(size_t index) const;
+};
@@ -0,0 +1,374 @@
+// Measures the throughput of remote_journal_reader against local fake
+// gatewayd servers and of outputter::add_line on a recorded headless
+// terminal.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+
+#include "allocation_counter.h"
+#include "checkpoint_manager.h"
+#include "export_generator.h"
+#include "fake_gatewayd.h"
+#include "ingest_queue.h"
+#include "io_service_pool.h"
+#include "journal_filter.h"
+#include "metrics.h"
+#include "outputter.h"
+#include "reconnect_scheduler.h"
+#include "remote_journal_reader.h"
+
+// Included last as its macros clash with asio.
+#include <curses.h>
+
+namespace
+{
+double process_cpu_seconds()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+double thread_cpu_seconds(pthread_t thread)
+{
+  clockid_t clock;
+  timespec time;
+  if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &time) != 0)
+    return 0;
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Counts the entries and stops io_service once all expected ones arrived or
+// were shed. Spends cost on each entry to stand in for a slow display.
+class counting_sink : public entry_sink
+{
+  boost::asio::io_service& io_service;
+  const size_t expected;
+  const std::chrono::microseconds cost;
+  std::function<uint64_t()> shed;
+  boost::asio::deadline_timer shed_timer;
+  size_t received = 0;
+
+  void check_shed()
+  {
+    shed_timer.expires_from_now(boost::posix_time::milliseconds(10));
+    shed_timer.async_wait([this](const boost::system::error_code& error) {
+      if (error)
+        return;
+      if (received + shed() >= expected)
+        io_service.stop();
+      else
+        check_shed();
+    });
+  }
+
+public:
+  counting_sink(boost::asio::io_service& io_service, size_t expected, std::chrono::microseconds cost)
+    : io_service(io_service)
+    , expected(expected)
+    , cost(cost)
+    , shed_timer(io_service)
+  {
+  }
+
+  // The last entries may be shed, so check for them regularly.
+  void watch_shed(std::function<uint64_t()> count)
+  {
+    shed = std::move(count);
+    check_shed();
+  }
+
+  void add_line(const journal_entry&) override
+  {
+    if (cost.count() > 0)
+    {
+      const auto until = std::chrono::steady_clock::now() + cost;
+      while (std::chrono::steady_clock::now() < until)
+        ;
+    }
+
+    if (++received == expected)
+      io_service.stop();
+  }
+
+  size_t count() const
+  {
+    return received;
+  }
+};
+
+uint64_t shed_entries(metrics& stats, size_t sources)
+{
+  uint64_t result = 0;
+  for (size_t i = 0; i < sources; ++i)
+  {
+    for (auto&& c : stats.find_source(i)->shed)
+      result += c.get();
+  }
+  return result;
+}
+
+void benchmark_readers(const export_generator_options& generator_options, const fake_gatewayd_options& server_options, size_t hosts, size_t threads, bool all_fields, bool resume, size_t catch_up_chunk, bool load_shedding, std::chrono::microseconds sink_cost)
+{
+  boost::asio::io_service server_io_service;
+  std::vector<std::unique_ptr<fake_gatewayd>> servers;
+  size_t body_size = 0;
+
+  for (size_t i = 0; i < hosts; ++i)
+  {
+    export_generator_options options = generator_options;
+    options.hostname = (boost::format("host%1%") % i).str();
+    std::string body = generate_export(options);
+    body_size += body.size();
+    servers.push_back(std::make_unique<fake_gatewayd>(server_io_service, std::move(body), server_options));
+  }
+
+  boost::asio::io_service::work server_work(server_io_service);
+  std::thread server_thread([&server_io_service]() { server_io_service.run(); });
+
+  char cursor_path[] = "/tmp/journal-comvi-bench.XXXXXX";
+  if (mkdtemp(cursor_path) == nullptr)
+  {
+    perror("mkdtemp");
+    exit(1);
+  }
+
+  std::vector<std::string> projection;
+  if (!all_fields)
+  {
+    for (field_id id = 0; id < static_cast<field_id>(well_known_field::count); ++id)
+    {
+      projection.push_back(field_names::name(id).to_string());
+    }
+  }
+
+  if (resume)
+  {
+    // Let every reader resume after the first entry, as after a restart.
+    for (auto&& server : servers)
+    {
+      const std::string path = (boost::format("%1%/127.0.0.1:%2%") % cursor_path % server->port()).str();
+      std::ofstream(path) << server->cursor(0);
+    }
+  }
+
+  boost::asio::io_service io_service(1);
+  boost::asio::io_service::work work(io_service);
+  // Catching up skips the entry of the stored cursor, following does not.
+  const size_t expected = hosts * (resume && catch_up_chunk > 0 ? generator_options.entries - 1 : generator_options.entries);
+
+  {
+    checkpoint_manager checkpoints(io_service, cursor_path, boost::posix_time::seconds(1), 1000);
+    reconnect_scheduler scheduler(io_service, boost::posix_time::seconds(1), boost::posix_time::seconds(60), hosts);
+    metrics stats;
+    counting_sink sink(io_service, expected, sink_cost);
+    io_service_pool reader_pool(threads);
+    ingest_queue queue(io_service, 65536, stats, load_shedding, hosts, sink);
+    entry_sink& reader_sink = threads > 0 ? static_cast<entry_sink&>(queue) : sink;
+    journal_filter filter;
+
+    const double start_cpu = process_cpu_seconds();
+    const double start_server_cpu = thread_cpu_seconds(server_thread.native_handle());
+    const uint64_t start_allocations = allocation_count();
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::unique_ptr<remote_journal_reader>> readers;
+    for (auto&& server : servers)
+    {
+      boost::asio::io_service& reader_io_service = threads > 0 ? reader_pool.get_io_service() : io_service;
+      const std::string address = (boost::format("127.0.0.1:%1%") % server->port()).str();
+      readers.push_back(std::make_unique<remote_journal_reader>(reader_io_service, checkpoints, scheduler, stats, filter, projection, catch_up_chunk, address, reader_sink));
+    }
+
+    if (load_shedding)
+      sink.watch_shed([&stats, hosts]() { return shed_entries(stats, hosts); });
+
+    reader_pool.run();
+    io_service.run();
+
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    const uint64_t allocations = allocation_count() - start_allocations;
+    const double cpu = (process_cpu_seconds() - start_cpu) - (thread_cpu_seconds(server_thread.native_handle()) - start_server_cpu);
+
+    uint64_t wire_size = 0;
+    for (auto&& reader : readers)
+      wire_size += reader->bytes_received();
+
+    queue.close();
+    reader_pool.stop();
+
+    std::cout << boost::format("readers: %1% hosts, %2% threads, %3%%4%%5%%6%%7%\n") % hosts % threads % (all_fields ? "all fields" : "projected") % (server_options.gzip ? ", gzip" : "") % (server_options.keep_alive ? ", keep-alive" : "")
+      % (resume ? (catch_up_chunk > 0 ? (boost::format(", catching up in chunks of %1%") % catch_up_chunk).str() : ", resuming with follow") : "")
+      % (load_shedding ? ", load shedding" : "");
+    std::cout << boost::format("  %10.0f entries/s %8.1f MB/s %8.2f us CPU/entry %8.2f allocations/entry\n")
+      % (expected / duration.count())
+      % (body_size / duration.count() / 1e6)
+      % (cpu * 1e6 / expected)
+      % (static_cast<double>(allocations) / expected);
+    std::cout << boost::format("  %10.1f MB on the wire for %.1f MB of entries\n")
+      % (wire_size / 1e6)
+      % (body_size / 1e6);
+    if (load_shedding)
+      std::cout << boost::format("  %10u entries displayed, %u shed\n") % sink.count() % shed_entries(stats, hosts);
+  }
+
+  server_io_service.stop();
+  server_thread.join();
+
+  const std::string remove = std::string("rm -rf ") + cursor_path;
+  if (system(remove.c_str()) != 0)
+  {
+    std::cerr << "Failed to remove " << cursor_path << '\n';
+  }
+}
+
+// With lines_per_frame 0 the lines are added as fast as possible and most
+// of them are skipped. Otherwise a frame is drawn after every
+// lines_per_frame lines, like for a host logging at a moderate rate.
+void benchmark_outputter(size_t lines, size_t message_size, bool errors, size_t lines_per_frame)
+{
+  // Records what would be sent to the terminal.
+  FILE* terminal = tmpfile();
+  SCREEN* screen = newterm("xterm", terminal, stdin);
+  if (screen == nullptr)
+  {
+    std::cerr << "Could not create terminal\n";
+    return;
+  }
+  set_term(screen);
+  // Set up like the ncurses class does.
+  start_color();
+  use_default_colors();
+  scrollok(stdscr, TRUE);
+  leaveok(stdscr, TRUE);
+  init_pair(1, COLOR_RED, -1);
+  init_pair(2, COLOR_YELLOW, -1);
+  init_pair(3, COLOR_BLUE, -1);
+
+  boost::asio::io_service io_service;
+
+  {
+    metrics stats;
+    const boost::posix_time::time_duration frame_interval = lines_per_frame > 0 ? boost::posix_time::milliseconds(0) : boost::posix_time::milliseconds(33);
+    outputter out(io_service, stats, frame_interval, 64 * 1024 * 1024);
+
+    std::vector<journal_entry> entries(100);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+      entries[i].add("__REALTIME_TIMESTAMP", std::to_string(1500000000000000 + i * 1000000));
+      // An error storm pins every line until the screen is full.
+      entries[i].add("PRIORITY", std::to_string(errors ? 3 : 4 + i % 4));
+      entries[i].add("_HOSTNAME", "host.example.com");
+      entries[i].add("_COMM", "example");
+      entries[i].add("MESSAGE", std::string(message_size, 'm'));
+    }
+
+    const uint64_t start_allocations = allocation_count();
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < lines; ++i)
+    {
+      out.add_line(entries[i % entries.size()]);
+      if (lines_per_frame > 0 ? (i + 1) % lines_per_frame == 0 : i % 1000 == 0)
+        io_service.poll();
+    }
+
+    // The status line timer keeps io_service busy, so stop once the last
+    // frame has been drawn.
+    boost::asio::deadline_timer done(io_service, frame_interval + boost::posix_time::milliseconds(1));
+    done.async_wait([&io_service](const boost::system::error_code&) { io_service.stop(); });
+    io_service.run();
+
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    const uint64_t allocations = allocation_count() - start_allocations;
+
+    struct stat terminal_stat;
+    const uint64_t terminal_bytes = fstat(fileno(terminal), &terminal_stat) == 0 ? terminal_stat.st_size : 0;
+    const uint64_t drawn = lines - std::min<uint64_t>(lines, stats.skipped_lines.get());
+
+    std::cout << "outputter::add_line" << (errors ? ", errors only" : "");
+    if (lines_per_frame > 0)
+      std::cout << ", " << lines_per_frame << " lines per frame";
+    std::cout << '\n';
+    std::cout << boost::format("  %10.0f lines/s %8.0f ns/line %8.2f allocations/line\n")
+      % (lines / duration.count())
+      % (duration.count() * 1e9 / lines)
+      % (static_cast<double>(allocations) / lines);
+    std::cout << boost::format("  %10u lines drawn %8.1f terminal bytes/line %8u bytes/frame p50\n")
+      % drawn
+      % (drawn > 0 ? static_cast<double>(terminal_bytes) / drawn : 0)
+      % stats.frame_bytes.quantile(0.5);
+  }
+
+  endwin();
+  delscreen(screen);
+  fclose(terminal);
+}
+}
+
+int main(int argc, char** argv)
+{
+  export_generator_options generator_options;
+  fake_gatewayd_options server_options;
+  size_t hosts = 4;
+  size_t threads = 0;
+  size_t lines = 200000;
+  size_t catch_up_chunk = 10000;
+  size_t sink_cost = 0;
+  size_t lines_per_frame = 4;
+
+  namespace po = boost::program_options;
+  po::options_description description("options");
+  description.add_options()
+    ("help,h", "print this help message")
+    ("hosts", po::value<size_t>(&hosts)->default_value(hosts), "number of fake gatewayd hosts")
+    ("entries", po::value<size_t>(&generator_options.entries)->default_value(generator_options.entries), "entries sent by each host")
+    ("fields", po::value<size_t>(&generator_options.fields)->default_value(generator_options.fields), "fields per entry")
+    ("message-size", po::value<size_t>(&generator_options.message_size)->default_value(generator_options.message_size), "bytes per message")
+    ("binary-ratio", po::value<double>(&generator_options.binary_ratio)->default_value(generator_options.binary_ratio), "fraction of entries with a binary field")
+    ("binary-size", po::value<size_t>(&generator_options.binary_size)->default_value(generator_options.binary_size), "bytes per binary field")
+    ("threads", po::value<size_t>(&threads)->default_value(threads), "reader threads, 0 reads on the main thread")
+    ("all-fields", "read all fields instead of only the displayed ones")
+    ("gzip", "let the servers compress the entries with gzip")
+    ("keep-alive", "let the servers end the first response, so the readers send a second request on the same connection")
+    ("resume", "let the readers resume from a stored cursor, so they catch up on the backlog first")
+    ("catch-up-chunk", po::value<size_t>(&catch_up_chunk)->default_value(catch_up_chunk), "entries requested at once while catching up, 0 follows right away")
+    ("load-shedding", "let the queue of the reader threads drop entries of low priority when it fills up")
+    ("sink-cost", po::value<size_t>(&sink_cost)->default_value(sink_cost), "microseconds spent on each received entry, to simulate a slow display")
+    ("lines", po::value<size_t>(&lines)->default_value(lines), "lines passed to outputter::add_line")
+    ("lines-per-frame", po::value<size_t>(&lines_per_frame)->default_value(lines_per_frame), "lines added between frames in the last outputter run, 0 skips it");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, description), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << description << '\n';
+    return 1;
+  }
+
+  server_options.gzip = vm.count("gzip") > 0;
+  server_options.keep_alive = vm.count("keep-alive") > 0;
+
+  benchmark_readers(generator_options, server_options, hosts, threads, vm.count("all-fields") > 0, vm.count("resume") > 0, catch_up_chunk, vm.count("load-shedding") > 0, std::chrono::microseconds(sink_cost));
+  benchmark_outputter(lines, generator_options.message_size, false, 0);
+  benchmark_outputter(lines, generator_options.message_size, true, 0);
+  if (lines_per_frame > 0)
+    benchmark_outputter(lines, generator_options.message_size, false, lines_per_frame);
+
+  return 0;
+}
@@ -0,0 +1,75 @@
+// Measures parsing of the journal export format with and without projecting
+// the fields needed for display.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "export_generator.h"
+#include "export_parser.h"
+#include "journal_entry.h"
+
+namespace
+{
+void run(const std::string& name, const std::string& data, const std::vector<std::string>& projection)
+{
+  const size_t chunk_size = 64 * 1024;
+
+  export_parser parser;
+  parser.set_projection(projection);
+  journal_entry entry;
+  size_t entries = 0;
+  size_t copied = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (size_t pos = 0; pos < data.size(); pos += chunk_size)
+  {
+    const size_t size = std::min(chunk_size, data.size() - pos);
+    parser.append(data.data() + pos, size);
+    parser.parse([&](const std::vector<export_parser::field>& fields) {
+      entry.clear();
+      for (auto&& field : fields)
+      {
+        entry.add(field.name, field.value);
+        copied += field.value.size();
+      }
+      ++entries;
+    });
+  }
+
+  const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+  std::cout << boost::format("%-12s %10.0f entries/s %8.1f MB/s %8.1f bytes copied/entry %8.1f bytes skipped/entry\n")
+    % name
+    % (entries / duration.count())
+    % (data.size() / duration.count() / 1e6)
+    % (static_cast<double>(copied) / entries)
+    % (static_cast<double>(parser.skipped_bytes()) / entries);
+}
+}
+
+int main(int argc, char** argv)
+{
+  export_generator_options options;
+  options.entries = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  options.binary_ratio = argc > 2 ? std::strtod(argv[2], nullptr) : 0.1;
+
+  const std::string data = generate_export(options);
+  std::cout << boost::format("%1% entries, %2% bytes received/entry\n") % options.entries % (data.size() / options.entries);
+
+  std::vector<std::string> projection;
+  for (field_id id = 0; id < static_cast<field_id>(well_known_field::count); ++id)
+  {
+    projection.push_back(field_names::name(id).to_string());
+  }
+
+  run("all fields", data, {});
+  run("projected", data, projection);
+
+  return 0;
+}
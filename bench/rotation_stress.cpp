@@ -0,0 +1,208 @@
+// Writes numbered entries into journal files in a test directory while
+// rotating to new files and deleting old ones, and checks that
+// local_journal_reader sees every entry exactly once.
+//
+// The files are written by systemd-journal-remote, which turns the journal
+// export format read from stdin into a journal file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <thread>
+
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+
+#include "checkpoint_manager.h"
+#include "journal_filter.h"
+#include "local_journal_reader.h"
+#include "metrics.h"
+
+namespace
+{
+const uint64_t start_timestamp = 1500000000000000;
+
+// Checks that the sequence numbers in MESSAGE arrive in order without
+// duplicates. Gaps are only possible if a file was deleted before it was
+// read.
+class checking_sink : public entry_sink
+{
+  boost::asio::io_service& io_service;
+  const uint64_t expected;
+
+public:
+  uint64_t received = 0;
+  uint64_t duplicates = 0;
+  uint64_t missing = 0;
+  uint64_t next = 0;
+
+  checking_sink(boost::asio::io_service& io_service, uint64_t expected)
+    : io_service(io_service)
+    , expected(expected)
+  {
+  }
+
+  void add_line(const journal_entry& entry) override
+  {
+    ++received;
+    const uint64_t sequence = std::stoull(entry.get(well_known_field::message).substr(7).to_string());
+    if (sequence < next)
+    {
+      ++duplicates;
+      return;
+    }
+
+    missing += sequence - next;
+    next = sequence + 1;
+    if (next == expected)
+      io_service.stop();
+  }
+};
+
+struct writer_options
+{
+  std::string journal_remote = "/usr/lib/systemd/systemd-journal-remote";
+  std::string directory;
+  uint64_t entries = 200000;
+  uint64_t rotate_entries = 10000;
+  size_t keep_files = 4;
+  // Pause after every batch of 100 entries.
+  std::chrono::microseconds pause{1000};
+};
+
+void write_journal(const writer_options& options, std::atomic<bool>& failed)
+{
+  std::deque<std::string> files;
+  uint64_t sequence = 0;
+  // Every rotation writes a new file, even once old ones are deleted.
+  uint64_t file_number = 0;
+
+  while (sequence < options.entries)
+  {
+    const std::string path = (boost::format("%1%/stress-%2%.journal") % options.directory % file_number++).str();
+    const std::string command = options.journal_remote + " --output=" + path + " - 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "w");
+    if (pipe == nullptr)
+    {
+      perror("popen");
+      failed = true;
+      return;
+    }
+
+    for (uint64_t i = 0; i < options.rotate_entries && sequence < options.entries; ++i, ++sequence)
+    {
+      fprintf(pipe, "__REALTIME_TIMESTAMP=%llu\n__MONOTONIC_TIMESTAMP=%llu\n_BOOT_ID=5f1e2d3c4b5a69788796a5b4c3d2e1f0\n_HOSTNAME=stress\nPRIORITY=6\nMESSAGE=stress %llu\n\n",
+        static_cast<unsigned long long>(start_timestamp + sequence),
+        static_cast<unsigned long long>(sequence),
+        static_cast<unsigned long long>(sequence));
+      if (i % 100 == 99)
+      {
+        fflush(pipe);
+        std::this_thread::sleep_for(options.pause);
+      }
+    }
+
+    if (pclose(pipe) != 0)
+    {
+      std::cerr << "systemd-journal-remote failed writing " << path << '\n';
+      failed = true;
+      return;
+    }
+
+    files.push_back(path);
+    if (files.size() > options.keep_files)
+    {
+      unlink(files.front().c_str());
+      files.pop_front();
+    }
+  }
+}
+}
+
+int main(int argc, char** argv)
+{
+  writer_options options;
+  long pause = options.pause.count();
+  long timeout = 120;
+
+  namespace po = boost::program_options;
+  po::options_description description("options");
+  description.add_options()
+    ("help,h", "print this help message")
+    ("journal-remote", po::value<std::string>(&options.journal_remote)->default_value(options.journal_remote), "path of systemd-journal-remote")
+    ("entries", po::value<uint64_t>(&options.entries)->default_value(options.entries), "entries written in total")
+    ("rotate-entries", po::value<uint64_t>(&options.rotate_entries)->default_value(options.rotate_entries), "entries written to each file")
+    ("keep-files", po::value<size_t>(&options.keep_files)->default_value(options.keep_files), "completed files kept before the oldest is deleted")
+    ("pause", po::value<long>(&pause)->default_value(pause), "microseconds to pause after every 100 entries")
+    ("timeout", po::value<long>(&timeout)->default_value(timeout), "seconds until the test is given up");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, description), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << description << '\n';
+    return 1;
+  }
+  options.pause = std::chrono::microseconds(pause);
+
+  char directory[] = "/tmp/journal-comvi-stress.XXXXXX";
+  if (mkdtemp(directory) == nullptr)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  options.directory = directory;
+  const std::string cursor_path = options.directory + "/cursors";
+  if (mkdir(cursor_path.c_str(), 0755) != 0)
+  {
+    perror("mkdir");
+    return 1;
+  }
+
+  boost::asio::io_service io_service(1);
+  boost::asio::io_service::work work(io_service);
+  boost::asio::deadline_timer deadline(io_service, boost::posix_time::seconds(timeout));
+  deadline.async_wait([&io_service](const boost::system::error_code& ec) {
+    if (!ec)
+      io_service.stop();
+  });
+
+  checking_sink sink(io_service, options.entries);
+  std::atomic<bool> failed(false);
+  const auto start = std::chrono::steady_clock::now();
+
+  {
+    checkpoint_manager checkpoints(io_service, cursor_path, boost::posix_time::seconds(1), 1000);
+    metrics stats;
+    journal_filter filter;
+
+    // The reader starts on the empty directory and only learns about the
+    // files as they are created.
+    local_journal_reader reader(io_service, checkpoints, stats, options.directory, filter, {}, 1024, std::chrono::milliseconds(5), sink);
+
+    std::thread writer([&options, &failed]() { write_journal(options, failed); });
+    io_service.run();
+    writer.join();
+  }
+
+  const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+  std::cout << boost::format("%1% of %2% entries received in %3$.1fs, %4% duplicates, %5% missing\n")
+    % sink.received % options.entries % duration.count() % sink.duplicates % (sink.missing + options.entries - sink.next);
+
+  const std::string remove = std::string("rm -rf ") + directory;
+  if (system(remove.c_str()) != 0)
+  {
+    std::cerr << "Failed to remove " << directory << '\n';
+  }
+
+  return !failed && sink.duplicates == 0 && sink.next == options.entries && sink.missing == 0 ? 0 : 1;
+}
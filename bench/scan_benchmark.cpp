@@ -0,0 +1,202 @@
+// Compares escaping JSON strings with the byte scanning kernels against the
+// byte by byte escaping stream_outputter did before, and splitting export
+// format fields with two memchr calls per line against find_line_end, which
+// export_parser uses.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "byte_scan.h"
+#include "export_generator.h"
+#include "line_format.h"
+
+
+namespace
+{
+const scan_kernel kernels[] = {scan_kernel::scalar, scan_kernel::sse2, scan_kernel::avx2};
+
+template <typename F>
+void run(const std::string& name, size_t bytes, size_t iterations, F f)
+{
+  size_t checksum = 0;
+  const auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < iterations; ++i)
+  {
+    checksum += f();
+    // Keeps the compiler from computing the result once for all iterations.
+    asm volatile("" : : : "memory");
+  }
+
+  const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+  std::cout << boost::format("  %-10s %8.1f MB/s (%d)\n")
+    % name
+    % (bytes * iterations / duration.count() / 1e6)
+    % (checksum % 10);
+}
+
+// append_json_string as stream_outputter had it.
+void escape_bytewise(const std::string& value, std::string& out)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  for (char c : value)
+  {
+    switch (c)
+    {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20)
+        {
+          out += "\\u00";
+          out += hex[(c >> 4) & 0xf];
+          out += hex[c & 0xf];
+        }
+        else
+        {
+          out += c;
+        }
+    }
+  }
+}
+
+void escape_json(const std::string& value, std::string& out)
+{
+  append_json_string(out, value);
+}
+
+template <typename F>
+size_t escape_all(const std::vector<std::string>& messages, std::string& out, F f)
+{
+  out.clear();
+  for (auto&& message : messages)
+    f(message, out);
+  return out.size();
+}
+
+// Export format fields are "NAME=value\n", entries end with an empty line.
+// All splitters return the number of fields plus the sum of the name
+// lengths, so their results can be compared.
+
+size_t split_memchr(const std::string& data)
+{
+  size_t result = 0;
+  const char* pos = data.data();
+  const char* const end = data.data() + data.size();
+  while (pos < end)
+  {
+    const char* newline = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    if (newline == nullptr)
+      break;
+    const char* equals = static_cast<const char*>(std::memchr(pos, '=', newline - pos));
+    if (equals != nullptr)
+      result += 1 + (equals - pos);
+    pos = newline + 1;
+  }
+  return result;
+}
+
+size_t split_kernel(const std::string& data)
+{
+  size_t result = 0;
+  const char* pos = data.data();
+  const char* const end = data.data() + data.size();
+  while (pos < end)
+  {
+    const char* equals;
+    const char* newline = find_line_end(pos, end, &equals);
+    if (newline == end)
+      break;
+    if (equals != nullptr)
+      result += 1 + (equals - pos);
+    pos = newline + 1;
+  }
+  return result;
+}
+}
+
+int main(int argc, char** argv)
+{
+  const size_t message_size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 80;
+  const size_t iterations = 100;
+
+  for (const scan_kernel kernel : kernels)
+  {
+    set_scan_kernel(kernel);
+    if (current_scan_kernel() != kernel)
+      std::cout << scan_kernel_name(kernel) << " is not supported by this CPU\n";
+  }
+
+  // Messages with an occasional quote, backslash or newline.
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> printable(' ', '~');
+  std::uniform_int_distribution<int> percent(0, 99);
+  std::vector<std::string> messages(10000);
+  size_t message_bytes = 0;
+  for (auto&& message : messages)
+  {
+    for (size_t i = 0; i < message_size; ++i)
+    {
+      char c = static_cast<char>(printable(random));
+      if (c == '"' || c == '\\')
+        c = 'x';
+      if (percent(random) == 0)
+        c = "\"\\\n"[percent(random) % 3];
+      message += c;
+    }
+    message_bytes += message.size();
+  }
+
+  std::string out;
+  std::cout << boost::format("escaping %1% JSON strings of %2% bytes\n") % messages.size() % message_size;
+  run("bytewise", message_bytes, iterations, [&]() { return escape_all(messages, out, escape_bytewise); });
+  for (const scan_kernel kernel : kernels)
+  {
+    set_scan_kernel(kernel);
+    if (current_scan_kernel() == kernel)
+      run(scan_kernel_name(kernel), message_bytes, iterations, [&]() { return escape_all(messages, out, escape_json); });
+  }
+
+  // Text fields only, binary fields are read by length and not searched.
+  export_generator_options generator_options;
+  generator_options.entries = 20000;
+  generator_options.message_size = message_size;
+  generator_options.binary_ratio = 0;
+  const std::string export_data = generate_export(generator_options);
+  const size_t split_iterations = 20;
+
+  std::cout << boost::format("splitting %1% export format entries of %2% fields (%3% MB)\n") % generator_options.entries % generator_options.fields % (export_data.size() / 1e6);
+  const size_t expected = split_memchr(export_data);
+  run("memchr", export_data.size(), split_iterations, [&]() { return split_memchr(export_data); });
+  for (const scan_kernel kernel : kernels)
+  {
+    set_scan_kernel(kernel);
+    if (current_scan_kernel() != kernel)
+      continue;
+    if (split_kernel(export_data) != expected)
+      std::cout << "  " << scan_kernel_name(kernel) << " split differs from memchr\n";
+    run(scan_kernel_name(kernel), export_data.size(), split_iterations, [&]() { return split_kernel(export_data); });
+  }
+
+  return 0;
+}
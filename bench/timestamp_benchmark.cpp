@@ -0,0 +1,93 @@
+// Compares timestamp_formatter with formatting through boost::date_time and a
+// stringstream as outputter did before, for entries arriving at different
+// rates.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/date_time/c_local_time_adjustor.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "allocation_counter.h"
+#include "timestamp_formatter.h"
+
+namespace
+{
+void append_boost(const std::string& value, std::string& out)
+{
+  static std::locale locale(std::cout.getloc(), new boost::posix_time::time_facet("%H:%M:%S"));
+
+  long timestamp = boost::lexical_cast<long>(value);
+  boost::posix_time::ptime time(boost::gregorian::date(1970, 1, 1), boost::posix_time::microseconds(timestamp));
+  using local_adj = boost::date_time::c_local_adjustor<boost::posix_time::ptime>;
+  time = local_adj::utc_to_local(time);
+
+  std::stringstream time_stream;
+  time_stream.imbue(locale);
+  time_stream << time;
+  out += time_stream.str();
+}
+
+void append_formatter(timestamp_formatter& formatter, const std::string& value, std::string& out)
+{
+  uint64_t usec;
+  if (timestamp_formatter::parse(value, usec))
+    formatter.append(usec, out);
+}
+
+template <typename F>
+void run(const std::string& name, const std::vector<std::string>& timestamps, size_t iterations, F f)
+{
+  std::string out;
+  out.reserve(64);
+  size_t checksum = 0;
+
+  const uint64_t start_allocations = allocation_count();
+  const auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < iterations; ++i)
+  {
+    out.clear();
+    f(timestamps[i % timestamps.size()], out);
+    checksum += static_cast<unsigned char>(out[7]);
+  }
+
+  const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+  const uint64_t allocations = allocation_count() - start_allocations;
+
+  std::cout << boost::format("  %-10s %8.1f ns/timestamp %8.2f allocations/timestamp (%d)\n")
+    % name
+    % (duration.count() * 1e9 / iterations)
+    % (static_cast<double>(allocations) / iterations)
+    % (checksum % 10);
+}
+}
+
+int main(int argc, char** argv)
+{
+  const size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  const uint64_t begin = 1500000000000000;
+
+  // Microseconds between consecutive entries.
+  for (uint64_t step : {10, 10000, 1000000})
+  {
+    std::vector<std::string> timestamps;
+    for (size_t i = 0; i < 4096; ++i)
+    {
+      timestamps.push_back(std::to_string(begin + i * step));
+    }
+
+    std::cout << boost::format("one entry every %1% us\n") % step;
+    run("boost", timestamps, iterations / 10, append_boost);
+    timestamp_formatter formatter;
+    run("formatter", timestamps, iterations, [&formatter](const std::string& value, std::string& out) { append_formatter(formatter, value, out); });
+  }
+
+  return 0;
+}
@@ -0,0 +1,235 @@
+#include "byte_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BYTE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+using find_json_special_function = const char* (*)(const char*, const char*);
+// The kernels below leave *equal alone once it is set, so a wider one can
+// hand its rest to a narrower one.
+using find_line_end_function = const char* (*)(const char*, const char*, const char**);
+
+const char* find_json_special_scalar(const char* begin, const char* end)
+{
+  for (; begin != end; ++begin)
+  {
+    const char c = *begin;
+    if (c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x80)
+      return begin;
+  }
+  return end;
+}
+
+const char* find_line_end_scalar(const char* begin, const char* end, const char** equal)
+{
+  for (; begin != end; ++begin)
+  {
+    const char c = *begin;
+    if (c == '\n')
+      return begin;
+    if (c == '=' && equal != nullptr && *equal == nullptr)
+      *equal = begin;
+  }
+  return end;
+}
+
+#ifdef BYTE_SCAN_X86
+// Notes the first '=' of the equals mask in front of the first '\n' of the
+// newlines mask of the block at begin.
+inline void note_equal(const char* begin, unsigned newlines, unsigned equals, const char** equal)
+{
+  if (equal == nullptr || *equal != nullptr)
+    return;
+
+  if (newlines != 0)
+    equals &= (newlines & -newlines) - 1;
+  if (equals != 0)
+    *equal = begin + __builtin_ctz(equals);
+}
+
+__attribute__((target("sse2")))
+const char* find_json_special_sse2(const char* begin, const char* end)
+{
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  // Control characters are the bytes which stay unchanged by an unsigned
+  // minimum with 0x1f.
+  const __m128i control = _mm_set1_epi8(0x1f);
+
+  for (; end - begin >= 16; begin += 16)
+  {
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const __m128i found = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(data, quote), _mm_cmpeq_epi8(data, backslash)),
+      _mm_cmpeq_epi8(_mm_min_epu8(data, control), data));
+    // The sign bits of the data mark the bytes of at least 0x80.
+    const int mask = _mm_movemask_epi8(found) | _mm_movemask_epi8(data);
+    if (mask != 0)
+      return begin + __builtin_ctz(mask);
+  }
+
+  return find_json_special_scalar(begin, end);
+}
+
+__attribute__((target("avx2")))
+const char* find_json_special_avx2(const char* begin, const char* end)
+{
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1f);
+
+  for (; end - begin >= 32; begin += 32)
+  {
+    const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const __m256i found = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(data, quote), _mm256_cmpeq_epi8(data, backslash)),
+      _mm256_cmpeq_epi8(_mm256_min_epu8(data, control), data));
+    const unsigned mask = _mm256_movemask_epi8(found) | _mm256_movemask_epi8(data);
+    if (mask != 0)
+      return begin + __builtin_ctz(mask);
+  }
+
+  // The rest is shorter than 32 bytes.
+  return find_json_special_sse2(begin, end);
+}
+
+__attribute__((target("sse2")))
+const char* find_line_end_sse2(const char* begin, const char* end, const char** equal)
+{
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i equal_sign = _mm_set1_epi8('=');
+
+  for (; end - begin >= 16; begin += 16)
+  {
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    const unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(data, newline));
+    note_equal(begin, newlines, _mm_movemask_epi8(_mm_cmpeq_epi8(data, equal_sign)), equal);
+    if (newlines != 0)
+      return begin + __builtin_ctz(newlines);
+  }
+
+  return find_line_end_scalar(begin, end, equal);
+}
+
+__attribute__((target("avx2")))
+const char* find_line_end_avx2(const char* begin, const char* end, const char** equal)
+{
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i equal_sign = _mm256_set1_epi8('=');
+
+  for (; end - begin >= 32; begin += 32)
+  {
+    const __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const unsigned newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(data, newline));
+    note_equal(begin, newlines, _mm256_movemask_epi8(_mm256_cmpeq_epi8(data, equal_sign)), equal);
+    if (newlines != 0)
+      return begin + __builtin_ctz(newlines);
+  }
+
+  // The rest is shorter than 32 bytes.
+  return find_line_end_sse2(begin, end, equal);
+}
+#endif
+
+bool supported(scan_kernel kernel)
+{
+  switch (kernel)
+  {
+    case scan_kernel::scalar:
+      return true;
+#ifdef BYTE_SCAN_X86
+    case scan_kernel::sse2:
+      return __builtin_cpu_supports("sse2");
+    case scan_kernel::avx2:
+      return __builtin_cpu_supports("avx2");
+#else
+    default:
+      return false;
+#endif
+  }
+  return false;
+}
+
+scan_kernel best_kernel()
+{
+  if (supported(scan_kernel::avx2))
+    return scan_kernel::avx2;
+  if (supported(scan_kernel::sse2))
+    return scan_kernel::sse2;
+  return scan_kernel::scalar;
+}
+
+struct kernel_table
+{
+  scan_kernel kernel;
+  find_json_special_function find_json_special;
+  find_line_end_function find_line_end;
+
+  explicit kernel_table(scan_kernel requested)
+  {
+    kernel = supported(requested) ? requested : best_kernel();
+    switch (kernel)
+    {
+#ifdef BYTE_SCAN_X86
+      case scan_kernel::avx2:
+        find_json_special = find_json_special_avx2;
+        find_line_end = find_line_end_avx2;
+        break;
+      case scan_kernel::sse2:
+        find_json_special = find_json_special_sse2;
+        find_line_end = find_line_end_sse2;
+        break;
+#endif
+      default:
+        find_json_special = find_json_special_scalar;
+        find_line_end = find_line_end_scalar;
+        break;
+    }
+  }
+};
+
+kernel_table& table()
+{
+  static kernel_table instance(best_kernel());
+  return instance;
+}
+}
+
+scan_kernel current_scan_kernel()
+{
+  return table().kernel;
+}
+
+void set_scan_kernel(scan_kernel kernel)
+{
+  table() = kernel_table(kernel);
+}
+
+const char* scan_kernel_name(scan_kernel kernel)
+{
+  switch (kernel)
+  {
+    case scan_kernel::scalar:
+      return "scalar";
+    case scan_kernel::sse2:
+      return "sse2";
+    case scan_kernel::avx2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+const char* find_json_special(const char* begin, const char* end)
+{
+  return table().find_json_special(begin, end);
+}
+
+const char* find_line_end(const char* begin, const char* end, const char** equal)
+{
+  if (equal != nullptr)
+    *equal = nullptr;
+  return table().find_line_end(begin, end, equal);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Vectorized search for the bytes which need escaping and for the line and
+// field separators of the export format.
+//
+// The widest instruction set supported by the CPU is picked on first use:
+// AVX2, SSE2 or a plain loop.
+
+enum class scan_kernel
+{
+  scalar,
+  sse2,
+  avx2
+};
+
+// The kernel used by the functions below.
+scan_kernel current_scan_kernel();
+
+// Switches to another kernel, e.g. to compare them. Falls back to the best
+// supported one if the CPU lacks the instructions. Not thread safe.
+void set_scan_kernel(scan_kernel kernel);
+
+const char* scan_kernel_name(scan_kernel kernel);
+
+// Finds the first byte which needs escaping in a JSON string: '"', '\\' or a
+// control character below 0x20, or a byte of at least 0x80, which has to be
+// checked for valid UTF-8. Returns end if there is none.
+const char* find_json_special(const char* begin, const char* end);
+
+// Finds the first '\n' in one pass, like memchr. If equal is not null, it is
+// set to the first '=' in front of the '\n', or to nullptr if there is none.
+// Returns end if there is no '\n'.
+const char* find_line_end(const char* begin, const char* end, const char** equal);
@@ -0,0 +1,176 @@
+#include "checkpoint_manager.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <boost/bind.hpp>
+
+#include <systemd/sd-journal.h>
+
+checkpoint_manager::checkpoint_manager(boost::asio::io_service& io_service, const std::string& path, boost::posix_time::time_duration flush_interval, size_t flush_entries)
+  : path(path)
+  , flush_interval(flush_interval)
+  , flush_entries(flush_entries)
+  , timer(io_service)
+{
+}
+
+checkpoint_manager::~checkpoint_manager()
+{
+  flush(true);
+}
+
+checkpoint_manager::source_id checkpoint_manager::add_source(const std::string& name)
+{
+  source s;
+  s.file_path = path + "/" + name;
+
+  std::ifstream file(s.file_path);
+  file >> s.cursor;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  sources.push_back(std::move(s));
+  return sources.size() - 1;
+}
+
+std::string checkpoint_manager::cursor(source_id id)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return sources[id].cursor;
+}
+
+void checkpoint_manager::update(source_id id, boost::string_view cursor)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  source& s = sources[id];
+  s.cursor.assign(cursor.data(), cursor.size());
+  s.dirty = true;
+
+  if (++pending_updates >= flush_entries)
+  {
+    lock.unlock();
+    flush(false);
+    return;
+  }
+
+  if (!timer_pending)
+  {
+    timer_pending = true;
+    timer.expires_from_now(flush_interval);
+    timer.async_wait(boost::bind(&checkpoint_manager::on_timer, this, _1));
+  }
+}
+
+void checkpoint_manager::on_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    timer_pending = false;
+  }
+
+  flush(false);
+}
+
+void checkpoint_manager::flush(bool sync)
+{
+  std::lock_guard<std::mutex> flush_lock(flush_mutex);
+
+  // Collect the changes first so that the files are written without holding
+  // the lock.
+  std::vector<std::pair<std::string, std::string>> changes;
+  std::vector<std::string> unsynced_files;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto&& s : sources)
+    {
+      if (s.dirty)
+      {
+        changes.emplace_back(s.file_path, s.cursor);
+        s.dirty = false;
+        s.unsynced = !sync;
+      }
+      else if (sync && s.unsynced)
+      {
+        unsynced_files.push_back(s.file_path);
+        s.unsynced = false;
+      }
+    }
+
+    pending_updates = 0;
+  }
+
+  for (auto&& change : changes)
+  {
+    write(change.first, change.second, sync);
+  }
+
+  for (auto&& file_path : unsynced_files)
+  {
+    sync_file(file_path);
+  }
+
+  if ((!changes.empty() || !unsynced_files.empty()) && sync)
+  {
+    // Make the renames themselves durable.
+    int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+      fsync(dir_fd);
+      close(dir_fd);
+    }
+  }
+}
+
+void checkpoint_manager::write(const std::string& file_path, const std::string& cursor, bool sync)
+{
+  const std::string temp_path = file_path + ".tmp";
+
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    sd_journal_print(LOG_WARNING, "Error opening cursor file '%s': %s", temp_path.c_str(), strerror(errno));
+    return;
+  }
+
+  bool ok = ::write(fd, cursor.data(), cursor.size()) == static_cast<ssize_t>(cursor.size());
+  if (ok && sync)
+  {
+    ok = fsync(fd) == 0;
+  }
+
+  if (!ok)
+  {
+    sd_journal_print(LOG_WARNING, "Error writing cursor file '%s': %s", temp_path.c_str(), strerror(errno));
+  }
+
+  close(fd);
+
+  if (ok && std::rename(temp_path.c_str(), file_path.c_str()) != 0)
+  {
+    sd_journal_print(LOG_WARNING, "Error replacing cursor file '%s': %s", file_path.c_str(), strerror(errno));
+  }
+}
+
+void checkpoint_manager::sync_file(const std::string& file_path)
+{
+  int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fsync(fd) != 0)
+  {
+    sd_journal_print(LOG_WARNING, "Error syncing cursor file '%s': %s", file_path.c_str(), strerror(errno));
+  }
+
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
+
+// Stores the last read cursor of each source in a file named after it.
+//
+// Updates are only kept in memory until flush_interval has passed or
+// flush_entries updates have been made. A file is replaced atomically by
+// writing a temporary file and renaming it over the old one.
+//
+// Sources may update their cursor from any thread.
+class checkpoint_manager
+{
+  struct source
+  {
+    std::string file_path;
+    std::string cursor;
+    bool dirty = false;
+    // Written by a flush without sync and not fsynced since.
+    bool unsynced = false;
+  };
+
+  const std::string path;
+  const boost::posix_time::time_duration flush_interval;
+  const size_t flush_entries;
+  boost::asio::deadline_timer timer;
+  bool timer_pending = false;
+  size_t pending_updates = 0;
+  std::vector<source> sources;
+  std::mutex mutex;
+  // Serializes flushes, so an older cursor never overwrites a newer one.
+  std::mutex flush_mutex;
+
+  void write(const std::string& file_path, const std::string& cursor, bool sync);
+  void sync_file(const std::string& file_path);
+  void on_timer(const boost::system::error_code& ec);
+
+public:
+  using source_id = size_t;
+
+  checkpoint_manager(boost::asio::io_service& io_service, const std::string& path, boost::posix_time::time_duration flush_interval, size_t flush_entries);
+  ~checkpoint_manager();
+
+  // Registers a source and loads its last stored cursor.
+  source_id add_source(const std::string& name);
+
+  std::string cursor(source_id id);
+
+  void update(source_id id, boost::string_view cursor);
+
+  // Writes all changed cursors. With sync the data is also flushed to disk,
+  // including the files written by earlier flushes without sync.
+  void flush(bool sync);
+};
@@ -0,0 +1,148 @@
+#include "dedup_stage.h"
+
+#include <boost/bind.hpp>
+
+namespace
+{
+// Number of neighbouring slots searched for a message.
+const size_t probe_count = 8;
+
+const uint64_t fnv_offset = 14695981039346656037ull;
+const uint64_t fnv_prime = 1099511628211ull;
+
+uint64_t hash_append(uint64_t hash, boost::string_view value, bool skip_digits)
+{
+  bool in_digits = false;
+  for (const char c : value)
+  {
+    if (skip_digits && c >= '0' && c <= '9')
+    {
+      // A run of digits counts as a single '#'.
+      if (in_digits)
+        continue;
+      in_digits = true;
+      hash = (hash ^ '#') * fnv_prime;
+      continue;
+    }
+
+    in_digits = false;
+    hash = (hash ^ static_cast<unsigned char>(c)) * fnv_prime;
+  }
+
+  // Separates the fields.
+  return (hash ^ 0xff) * fnv_prime;
+}
+}
+
+dedup_stage::dedup_stage(boost::asio::io_service& io_service, boost::posix_time::time_duration window, size_t capacity, entry_sink& next)
+  : next(next)
+  , window(window)
+  , update_interval(std::min(window, boost::posix_time::time_duration(boost::posix_time::milliseconds(500))))
+  , timer(io_service)
+  , slots(std::max(capacity, probe_count))
+{
+  dirty.reserve(slots.size());
+}
+
+uint64_t dedup_stage::hash(const journal_entry& entry)
+{
+  uint64_t result = fnv_offset;
+  result = hash_append(result, entry.get(well_known_field::hostname), false);
+  result = hash_append(result, entry.get(well_known_field::comm), false);
+  result = hash_append(result, entry.get(well_known_field::message), true);
+  return result;
+}
+
+dedup_stage::slot& dedup_stage::find(uint64_t hash)
+{
+  const size_t first = hash % slots.size();
+  slot* oldest = nullptr;
+
+  for (size_t i = 0; i < probe_count; ++i)
+  {
+    slot& s = slots[(first + i) % slots.size()];
+    if (s.used && s.hash == hash)
+      return s;
+    if (oldest == nullptr || !s.used || (oldest->used && s.last_seen < oldest->last_seen))
+      oldest = &s;
+  }
+
+  // The held repeats of the replaced message must not get lost.
+  if (oldest->held > 0)
+    pass_on(*oldest);
+
+  oldest->hash = hash;
+  oldest->used = false;
+  return *oldest;
+}
+
+void dedup_stage::add_line(const journal_entry& entry)
+{
+  const auto now = boost::posix_time::microsec_clock::universal_time();
+  slot& s = find(hash(entry));
+  s.last_seen = ++sequence;
+
+  if (s.used && now - s.window_start < window)
+  {
+    ++s.repeats;
+    s.last = entry;
+    ++s.held;
+    if (!s.dirty)
+    {
+      s.dirty = true;
+      dirty.push_back(&s - slots.data());
+    }
+
+    if (!timer_scheduled)
+    {
+      timer_scheduled = true;
+      timer.expires_from_now(update_interval);
+      timer.async_wait(boost::bind(&dedup_stage::on_timer, this, _1));
+    }
+    return;
+  }
+
+  // A new message or the window of the previous one ended.
+  if (s.held > 0)
+    pass_on(s);
+
+  s.used = true;
+  s.repeats = 1;
+  s.window_start = now;
+  next.add_line(entry);
+}
+
+void dedup_stage::pass_on(slot& s)
+{
+  s.held = 0;
+  s.last.set_repeats(s.repeats);
+  next.add_line(s.last);
+}
+
+void dedup_stage::on_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  timer_scheduled = false;
+  pass_on_dirty();
+}
+
+void dedup_stage::flush()
+{
+  pass_on_dirty();
+  next.flush();
+}
+
+void dedup_stage::pass_on_dirty()
+{
+  for (const size_t index : dirty)
+  {
+    slot& s = slots[index];
+    s.dirty = false;
+    // The repeats of replaced messages were already passed on.
+    if (s.held > 0)
+      pass_on(s);
+  }
+  dirty.clear();
+}
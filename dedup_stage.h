@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "entry_sink.h"
+
+// Collapses repeated messages into a single line with a repeat count.
+//
+// Entries are identified by host, _COMM and MESSAGE with runs of digits
+// ignored, so retry counters or pids do not tell repeats apart. The first
+// entry of a message is passed on right away. Repeats within the window
+// are held back and passed on as one entry with repeats() set to the
+// number seen so far, at most once per update interval.
+//
+// Messages are tracked in a fixed number of slots. A slot is found by the
+// hash of the message among a few neighbours, and a new message replaces
+// the least recently seen of them.
+class dedup_stage : public entry_sink
+{
+  struct slot
+  {
+    uint64_t hash = 0;
+    bool used = false;
+    bool dirty = false;
+    // Repeats not passed on yet.
+    uint32_t held = 0;
+    uint32_t repeats = 0;
+    uint64_t last_seen = 0;
+    boost::posix_time::ptime window_start;
+    journal_entry last;
+  };
+
+  entry_sink& next;
+  const boost::posix_time::time_duration window;
+  const boost::posix_time::time_duration update_interval;
+  boost::asio::deadline_timer timer;
+  bool timer_scheduled = false;
+  std::vector<slot> slots;
+  // Slots with held repeats.
+  std::vector<size_t> dirty;
+  uint64_t sequence = 0;
+
+  static uint64_t hash(const journal_entry& entry);
+  slot& find(uint64_t hash);
+  void pass_on(slot& s);
+  void pass_on_dirty();
+  void on_timer(const boost::system::error_code& ec);
+
+public:
+  dedup_stage(boost::asio::io_service& io_service, boost::posix_time::time_duration window, size_t capacity, entry_sink& next);
+
+  void add_line(const journal_entry& entry) override;
+  void flush() override;
+};
@@ -0,0 +1,69 @@
+#include "entry_record.h"
+
+#include <algorithm>
+
+namespace
+{
+const size_t field_header_size = 2 + 4;
+
+template<typename T>
+void put(std::string& out, T value)
+{
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+T get(const char* data)
+{
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+}
+
+void append_entry_record(const journal_entry& entry, std::string& out)
+{
+  const size_t begin = out.size();
+  put<uint32_t>(out, 0);
+  put<uint32_t>(out, entry.source());
+  put<uint64_t>(out, entry.realtime_usec());
+  put<uint16_t>(out, static_cast<uint16_t>(std::min<size_t>(entry.size(), UINT16_MAX)));
+  size_t fields = 0;
+  entry.for_each([&out, &fields](boost::string_view name, boost::string_view value) {
+    if (++fields > UINT16_MAX)
+      return;
+    put<uint16_t>(out, static_cast<uint16_t>(name.size()));
+    put<uint32_t>(out, static_cast<uint32_t>(value.size()));
+    out.append(name.data(), name.size());
+    out.append(value.data(), value.size());
+  });
+
+  const uint32_t size = static_cast<uint32_t>(out.size() - begin);
+  std::memcpy(&out[begin], &size, sizeof(size));
+}
+
+bool read_entry_record(const char* data, size_t size, journal_entry& entry)
+{
+  if (size < entry_record_header_size)
+    return false;
+
+  entry.clear();
+  entry.set_source(get<uint32_t>(data + 4));
+  const uint16_t fields = get<uint16_t>(data + 16);
+  const char* field = data + entry_record_header_size;
+  const char* const end = data + size;
+  for (uint16_t i = 0; i < fields; ++i)
+  {
+    if (static_cast<size_t>(end - field) < field_header_size)
+      return false;
+    const uint16_t name_size = get<uint16_t>(field);
+    const uint32_t value_size = get<uint32_t>(field + 2);
+    field += field_header_size;
+    if (static_cast<size_t>(end - field) < static_cast<size_t>(name_size) + value_size)
+      return false;
+    entry.add(boost::string_view(field, name_size), boost::string_view(field + name_size, value_size));
+    field += name_size + value_size;
+  }
+
+  return true;
+}
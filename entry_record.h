@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "journal_entry.h"
+
+// Compact binary form of a journal entry, used by entry_spool and to pass
+// entries from worker processes to the display process.
+//
+// A record is laid out as
+//   uint32 size of the whole record
+//   uint32 source
+//   uint64 __REALTIME_TIMESTAMP, in the spool the time it was appended
+//   uint16 number of fields
+//   per field: uint16 name size, uint32 value size, name, value
+// in the byte order of the machine.
+const size_t entry_record_header_size = 4 + 4 + 8 + 2;
+
+// Appends the record of entry to out. Fields beyond the 65535th are left out.
+void append_entry_record(const journal_entry& entry, std::string& out);
+
+// Reads a record of size bytes into entry. Returns false if the fields do not
+// fit into the record.
+bool read_entry_record(const char* data, size_t size, journal_entry& entry);
+
+inline uint32_t entry_record_size(const char* record)
+{
+  uint32_t size;
+  std::memcpy(&size, record, sizeof(size));
+  return size;
+}
+
+inline uint64_t entry_record_usec(const char* record)
+{
+  uint64_t usec;
+  std::memcpy(&usec, record + 8, sizeof(usec));
+  return usec;
+}
+
+// The timestamp in the header is only a copy, the entry keeps its own.
+inline void set_entry_record_usec(char* record, uint64_t usec)
+{
+  std::memcpy(record + 8, &usec, sizeof(usec));
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "journal_entry.h"
+
+// Receives the entries read from the journal sources.
+class entry_sink
+{
+public:
+  virtual ~entry_sink() = default;
+
+  virtual void add_line(const journal_entry& entry) = 0;
+
+  // Passes on or writes out everything held back, including what the next
+  // sinks hold. Called on shutdown once the sources have stopped, as their
+  // cursors already point behind these entries.
+  virtual void flush()
+  {
+  }
+};
@@ -0,0 +1,300 @@
+#include "entry_spool.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <system_error>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+
+#include <systemd/sd-journal.h>
+
+#include "entry_record.h"
+
+namespace
+{
+const size_t index_interval = 64 * 1024;
+
+// Entries passed on before other handlers get a chance to run.
+const size_t drain_batch_size = 1024;
+
+const char segment_prefix[] = "segment-";
+
+std::system_error spool_error(const std::string& what, const std::string& path)
+{
+  return std::system_error(errno, std::generic_category(), what + " '" + path + "'");
+}
+}
+
+entry_spool::entry_spool(boost::asio::io_service& io_service, const std::string& directory, size_t segment_size, size_t max_segments, uint32_t replay_source, entry_sink& next)
+  : io_service(io_service)
+  , directory(directory)
+  , segment_size(std::min<size_t>(std::max<size_t>(segment_size, 1024 * 1024), UINT32_MAX))
+  , max_segments(std::max<size_t>(max_segments, 2))
+  , replay_source(replay_source)
+  , next(next)
+{
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+    throw spool_error("Error creating spool directory", directory);
+
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr)
+    throw spool_error("Error opening spool directory", directory);
+
+  std::vector<uint64_t> numbers;
+  while (dirent* file = readdir(dir))
+  {
+    if (std::strncmp(file->d_name, segment_prefix, sizeof(segment_prefix) - 1) == 0)
+      numbers.push_back(std::strtoull(file->d_name + sizeof(segment_prefix) - 1, nullptr, 10));
+  }
+  closedir(dir);
+  std::sort(numbers.begin(), numbers.end());
+
+  for (uint64_t number : numbers)
+  {
+    map_segment(number, false);
+    scan_segment(segments.back());
+  }
+
+  if (segments.empty())
+    start_segment();
+
+  // Entries from an earlier run are only passed on by replay().
+  read_position = position{segments.back().number, segments.back().used};
+  run_start = read_position;
+}
+
+entry_spool::~entry_spool()
+{
+  for (auto&& s : segments)
+    munmap(s.data, segment_size);
+}
+
+std::string entry_spool::segment_path(uint64_t number) const
+{
+  return (boost::format("%1%/%2%%3$016d") % directory % segment_prefix % number).str();
+}
+
+void entry_spool::map_segment(uint64_t number, bool create)
+{
+  const std::string path = segment_path(number);
+  const int fd = open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0644);
+  if (fd < 0)
+    throw spool_error("Error opening spool segment", path);
+
+  // New files are filled with zeros, which terminates the records.
+  if (ftruncate(fd, segment_size) != 0)
+  {
+    close(fd);
+    throw spool_error("Error resizing spool segment", path);
+  }
+
+  void* data = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    throw spool_error("Error mapping spool segment", path);
+
+  segment s;
+  s.number = number;
+  s.data = static_cast<char*>(data);
+  segments.push_back(std::move(s));
+}
+
+void entry_spool::scan_segment(segment& s)
+{
+  uint32_t offset = 0;
+  uint32_t indexed = 0;
+  while (offset + entry_record_header_size <= segment_size)
+  {
+    // A zero size ends the records of a segment, a record cut short by a
+    // crash ends them as well.
+    const uint32_t size = entry_record_size(s.data + offset);
+    if (size < entry_record_header_size || offset + size > segment_size)
+      break;
+
+    const uint64_t usec = entry_record_usec(s.data + offset);
+    if (s.index.empty() || offset - indexed >= index_interval)
+    {
+      s.index.push_back(index_point{usec, offset});
+      indexed = offset;
+    }
+    last_append_usec = std::max(last_append_usec, usec);
+    offset += size;
+  }
+  s.used = offset;
+}
+
+void entry_spool::start_segment()
+{
+  const uint64_t number = segments.empty() ? 0 : segments.back().number + 1;
+  map_segment(number, true);
+
+  while (segments.size() > max_segments)
+  {
+    const segment& oldest = segments.front();
+    if (read_position.segment == oldest.number)
+    {
+      // The next sink fell behind by the whole spool.
+      size_t skipped = 0;
+      for (uint32_t offset = read_position.offset; offset < oldest.used; offset += entry_record_size(oldest.data + offset))
+        ++skipped;
+      sd_journal_print(LOG_WARNING, "Spool is full, skipped %zu entries which were not shown yet", skipped);
+      read_position = position{oldest.number + 1, 0};
+    }
+
+    munmap(oldest.data, segment_size);
+    unlink(segment_path(segments.front().number).c_str());
+    segments.pop_front();
+  }
+}
+
+entry_spool::segment* entry_spool::find_segment(uint64_t number)
+{
+  if (segments.empty() || number < segments.front().number || number > segments.back().number)
+    return nullptr;
+  return &segments[number - segments.front().number];
+}
+
+void entry_spool::add_line(const journal_entry& entry)
+{
+  // Encoded outside of the lock, each appending thread has its own buffer.
+  thread_local std::string record;
+  record.clear();
+  append_entry_record(entry, record);
+
+  // Leave room for the terminating zero size.
+  if (record.size() + 4 > segment_size)
+  {
+    sd_journal_print(LOG_WARNING, "Entry of %zu bytes does not fit into a spool segment", record.size());
+    return;
+  }
+  const uint32_t size = static_cast<uint32_t>(record.size());
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // Kept from going back if the clock is set back.
+  const uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  const uint64_t usec = std::max(now, last_append_usec);
+  last_append_usec = usec;
+  set_entry_record_usec(&record[0], usec);
+
+  if (segments.back().used + size + 4 > segment_size)
+  {
+    start_segment();
+  }
+
+  segment& current = segments.back();
+  if (current.index.empty() || current.used - current.index.back().offset >= index_interval)
+  {
+    current.index.push_back(index_point{usec, current.used});
+  }
+  std::memcpy(current.data + current.used, record.data(), record.size());
+  current.used += size;
+
+  schedule_drain();
+}
+
+void entry_spool::replay(uint64_t usec)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // The first index point at or after usec, or the start of the segment
+  // whose points are all older, is close in front of the first entry.
+  position start{segments.back().number, segments.back().used};
+  for (auto s = segments.rbegin(); s != segments.rend(); ++s)
+  {
+    auto point = std::lower_bound(s->index.begin(), s->index.end(), usec, [](const index_point& p, uint64_t usec) { return p.usec < usec; });
+    if (point != s->index.begin())
+    {
+      start = position{s->number, std::prev(point)->offset};
+      break;
+    }
+    start = position{s->number, 0};
+  }
+
+  // Skip the records in front of usec.
+  segment* s = find_segment(start.segment);
+  while (s != nullptr && start.offset < s->used && entry_record_usec(s->data + start.offset) < usec)
+  {
+    start.offset += entry_record_size(s->data + start.offset);
+    if (start.offset == s->used && s->number != segments.back().number)
+    {
+      start = position{s->number + 1, 0};
+      s = find_segment(start.segment);
+    }
+  }
+
+  read_position = start;
+  schedule_drain();
+}
+
+void entry_spool::schedule_drain()
+{
+  if (!drain_scheduled.exchange(true, std::memory_order_acq_rel))
+    io_service.post(boost::bind(&entry_spool::drain, this));
+}
+
+// Returns false once all stored entries are passed on.
+bool entry_spool::pass_on(size_t max_entries)
+{
+  for (size_t count = 0; count < max_entries; ++count)
+  {
+    {
+      // Released before the entry is passed on, so appending never waits
+      // for the next sink.
+      std::lock_guard<std::mutex> lock(mutex);
+
+      segment* s = find_segment(read_position.segment);
+      if (read_position.offset >= s->used)
+      {
+        if (s->number == segments.back().number)
+          return false;
+        read_position = position{s->number + 1, 0};
+        continue;
+      }
+
+      const bool replayed = read_position.segment < run_start.segment
+        || (read_position.segment == run_start.segment && read_position.offset < run_start.offset);
+      const char* data = s->data + read_position.offset;
+      const uint32_t size = entry_record_size(data);
+      read_position.offset += size;
+
+      // Only a record torn by a crash can be broken.
+      if (!read_entry_record(data, size, entry))
+      {
+        sd_journal_print(LOG_WARNING, "Skipped a broken record in spool segment %llu", static_cast<unsigned long long>(s->number));
+        continue;
+      }
+
+      if (replayed)
+        entry.set_source(replay_source);
+    }
+
+    next.add_line(entry);
+  }
+
+  return true;
+}
+
+void entry_spool::drain()
+{
+  // Reset first, an entry appended while draining will schedule another run.
+  drain_scheduled.store(false, std::memory_order_release);
+
+  if (pass_on(drain_batch_size))
+    schedule_drain();
+}
+
+void entry_spool::flush()
+{
+  pass_on(SIZE_MAX);
+  next.flush();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "entry_sink.h"
+
+// Stores received entries in memory-mapped files and passes them on from
+// there.
+//
+// Entries are appended to segment files of segment_size bytes in directory.
+// Once max_segments are written the oldest file is deleted. add_line may be
+// called from any thread and only copies the fields into the mapping, so
+// readers appending on their own threads are never held up by the next
+// sink. Spooled entries are passed on in batches posted to io_service; if
+// the next sink falls behind by more than the spool holds, the oldest
+// entries are skipped.
+//
+// Every index_interval bytes the time and offset of a record are noted in a
+// sparse index, so replay can start at a point in time without decoding all
+// records in front of it. The time is when the record was appended, which
+// unlike the timestamps of the entries of different hosts never goes back,
+// so the records are sorted by it. The files are kept when the program ends and
+// opened again on the next start. Source ids are only valid within one run,
+// so the entries of an earlier run are passed on with replay_source.
+class entry_spool : public entry_sink
+{
+  struct index_point
+  {
+    uint64_t usec;
+    uint32_t offset;
+  };
+
+  struct segment
+  {
+    uint64_t number;
+    char* data;
+    // End of the last record.
+    uint32_t used = 0;
+    std::vector<index_point> index;
+  };
+
+  struct position
+  {
+    uint64_t segment;
+    uint32_t offset;
+  };
+
+  boost::asio::io_service& io_service;
+  const std::string directory;
+  const size_t segment_size;
+  const size_t max_segments;
+  const uint32_t replay_source;
+  entry_sink& next;
+  // Guards the segments and positions against the appending threads.
+  std::mutex mutex;
+  std::deque<segment> segments;
+  // Where the next entry to pass on is stored.
+  position read_position{0, 0};
+  // Where the first entry of this run is stored.
+  position run_start{0, 0};
+  std::atomic<bool> drain_scheduled{false};
+  // Time of the last record appended, in microseconds since the epoch.
+  uint64_t last_append_usec = 0;
+  // Only used by the thread of io_service.
+  journal_entry entry;
+
+  std::string segment_path(uint64_t number) const;
+  void map_segment(uint64_t number, bool create);
+  void scan_segment(segment& s);
+  void start_segment();
+  segment* find_segment(uint64_t number);
+  void schedule_drain();
+  bool pass_on(size_t max_entries);
+  void drain();
+
+public:
+  // Opens the segments left in directory and creates it if necessary.
+  // Throws std::system_error on failure.
+  entry_spool(boost::asio::io_service& io_service, const std::string& directory, size_t segment_size, size_t max_segments, uint32_t replay_source, entry_sink& next);
+  ~entry_spool();
+
+  void add_line(const journal_entry& entry) override;
+  void flush() override;
+
+  // Passes on the stored entries received at or after usec, in front of any
+  // new ones. Called before the readers are started.
+  void replay(uint64_t usec);
+};
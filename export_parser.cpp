@@ -0,0 +1,207 @@
+#include "export_parser.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/endian/conversion.hpp>
+
+#include "byte_scan.h"
+
+export_parser::export_parser(size_t max_entry_size)
+  : max_entry_size(max_entry_size)
+{
+}
+
+boost::asio::mutable_buffers_1 export_parser::prepare(size_t size)
+{
+  if (end + size > buffer.size() && entry_begin > 0)
+  {
+    // Move the partial entry to the front instead of growing the buffer.
+    std::memmove(buffer.data(), buffer.data() + entry_begin, end - entry_begin);
+    parse_pos -= entry_begin;
+    end -= entry_begin;
+    entry_begin = 0;
+  }
+
+  if (end + size > buffer.size())
+  {
+    buffer.resize(std::max(end + size, buffer.size() * 2));
+  }
+
+  return boost::asio::buffer(buffer.data() + end, size);
+}
+
+void export_parser::commit(size_t size)
+{
+  end += size;
+}
+
+void export_parser::append(const char* data, size_t size)
+{
+  std::memcpy(boost::asio::buffer_cast<char*>(prepare(size)), data, size);
+  commit(size);
+}
+
+void export_parser::reset()
+{
+  entry_begin = 0;
+  parse_pos = 0;
+  end = 0;
+  skip_remaining = 0;
+  offsets.clear();
+}
+
+void export_parser::set_projection(const std::vector<std::string>& names)
+{
+  projection = names;
+}
+
+bool export_parser::projected(boost::string_view name) const
+{
+  if (projection.empty())
+    return true;
+
+  for (auto&& p : projection)
+  {
+    if (name == p)
+      return true;
+  }
+
+  return false;
+}
+
+export_parser::result export_parser::skip_binary()
+{
+  const size_t available = end - parse_pos;
+
+  if (available < skip_remaining)
+  {
+    // The received part is overwritten by the next read.
+    skip_remaining -= available;
+    skipped += available;
+    end = parse_pos;
+    return result::need_more;
+  }
+
+  skipped += skip_remaining;
+  parse_pos += skip_remaining;
+  skip_remaining = 0;
+
+  // The data is followed by a newline.
+  return buffer[parse_pos - 1] == '\n' ? result::skipped : result::error;
+}
+
+export_parser::result export_parser::next_entry()
+{
+  const char* data = buffer.data();
+
+  if (skip_remaining > 0)
+  {
+    const result r = skip_binary();
+    if (r != result::skipped)
+      return r;
+  }
+
+  while (parse_pos < end)
+  {
+    const char* line = data + parse_pos;
+    // Finds the '=' of a normal field in the same pass.
+    const char* equal;
+    const char* line_end = find_line_end(line, data + end, &equal);
+
+    if (line_end == data + end)
+    {
+      break;
+    }
+
+    const size_t line_length = line_end - line;
+
+    if (line_length == 0)
+    {
+      // An empty line terminates the entry.
+      ++parse_pos;
+
+      const char* entry = data + entry_begin;
+      fields.clear();
+      for (auto&& o : offsets)
+      {
+        fields.push_back(field{
+          boost::string_view(entry + o.name_begin, o.name_length),
+          boost::string_view(entry + o.value_begin, o.value_length)});
+      }
+
+      offsets.clear();
+      entry_begin = parse_pos;
+
+      if (fields.empty())
+      {
+        continue;
+      }
+
+      return result::entry;
+    }
+
+    if (equal != nullptr)
+    {
+      // Normal field.
+      const size_t name_length = equal - line;
+      if (projected(boost::string_view(line, name_length)))
+      {
+        offsets.push_back(field_offsets{
+          parse_pos - entry_begin, name_length,
+          parse_pos - entry_begin + name_length + 1, line_length - name_length - 1});
+      }
+      parse_pos += line_length + 1;
+      continue;
+    }
+
+    // No equal sign, this field is serialized in a binary safe way: the name
+    // is followed by a little endian 64 bit length, the data and a newline.
+    const size_t header_length = line_length + 1 + sizeof(uint64_t);
+    if (end - parse_pos < header_length)
+    {
+      break;
+    }
+
+    uint64_t size;
+    std::memcpy(&size, line + line_length + 1, sizeof(size));
+    boost::endian::little_to_native_inplace(size);
+
+    if (!projected(boost::string_view(line, line_length)))
+    {
+      parse_pos += header_length;
+      skip_remaining = size + 1;
+      const result r = skip_binary();
+      if (r != result::skipped)
+        return r;
+      continue;
+    }
+
+    if (size > max_entry_size)
+    {
+      return result::error;
+    }
+
+    if (end - parse_pos < header_length + size + 1)
+    {
+      break;
+    }
+
+    if (line[header_length + size] != '\n')
+    {
+      return result::error;
+    }
+
+    offsets.push_back(field_offsets{
+      parse_pos - entry_begin, line_length,
+      parse_pos - entry_begin + header_length, static_cast<size_t>(size)});
+    parse_pos += header_length + size + 1;
+  }
+
+  if (end - entry_begin > max_entry_size)
+  {
+    return result::error;
+  }
+
+  return result::need_more;
+}
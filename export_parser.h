@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/utility/string_view.hpp>
+
+// Incremental parser for the journal export format.
+//
+// Data is received directly into the parser's buffer (see prepare() and
+// commit()) and complete entries are scanned in place. The fields passed to
+// the entry handler point into this buffer and are only valid until the next
+// call to prepare().
+class export_parser
+{
+public:
+  struct field
+  {
+    boost::string_view name;
+    boost::string_view value;
+  };
+
+private:
+  enum class result
+  {
+    entry,
+    skipped,
+    need_more,
+    error
+  };
+
+  // Offsets are relative to entry_begin so that compacting the buffer does
+  // not invalidate fields of a partially received entry.
+  struct field_offsets
+  {
+    size_t name_begin;
+    size_t name_length;
+    size_t value_begin;
+    size_t value_length;
+  };
+
+  std::vector<char> buffer;
+  size_t entry_begin = 0;
+  size_t parse_pos = 0;
+  size_t end = 0;
+  const size_t max_entry_size;
+  std::vector<field_offsets> offsets;
+  std::vector<field> fields;
+  std::vector<std::string> projection;
+  // Remaining bytes of a binary field which is skipped without buffering it.
+  uint64_t skip_remaining = 0;
+  uint64_t skipped = 0;
+
+  bool projected(boost::string_view name) const;
+  result skip_binary();
+  result next_entry();
+
+public:
+  explicit export_parser(size_t max_entry_size = 64 * 1024 * 1024);
+
+  // Returns a buffer of at least size bytes to receive data into.
+  boost::asio::mutable_buffers_1 prepare(size_t size);
+
+  // Marks size bytes of the buffer returned by prepare() as received.
+  void commit(size_t size);
+
+  // Copies already received data into the parser.
+  void append(const char* data, size_t size);
+
+  // Calls handler with the fields of each complete entry received so far.
+  // Returns false if the stream is malformed.
+  template<typename EntryHandler>
+  bool parse(EntryHandler&& handler)
+  {
+    result r;
+    while ((r = next_entry()) == result::entry)
+    {
+      handler(fields);
+    }
+    return r != result::error;
+  }
+
+  // Discards all buffered data, e.g. after a reconnect.
+  void reset();
+
+  // Only passes the given fields to the entry handler. Other binary fields
+  // are discarded as they are received instead of being buffered. An empty
+  // projection passes all fields.
+  void set_projection(const std::vector<std::string>& names);
+
+  // Number of bytes of binary fields which were discarded without being read.
+  uint64_t skipped_bytes() const
+  {
+    return skipped;
+  }
+};
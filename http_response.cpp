@@ -0,0 +1,411 @@
+#include "http_response.h"
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+namespace
+{
+// Size of the buffers decompressed data is written to.
+const size_t output_size = 64 * 1024;
+
+boost::string_view trim(boost::string_view value)
+{
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+    value.remove_prefix(1);
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t' || value.back() == '\r'))
+    value.remove_suffix(1);
+  return value;
+}
+
+int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+}
+
+class body_decompressor
+{
+public:
+  virtual ~body_decompressor() = default;
+
+  // Decompresses all of data into parser. Returns false and sets error if
+  // the data is corrupt.
+  virtual bool decompress(const char* data, size_t size, export_parser& parser, std::string& error) = 0;
+};
+
+namespace
+{
+class gzip_decompressor : public body_decompressor
+{
+  z_stream stream;
+  // Result of inflateInit2, the stream may only be used if it is Z_OK.
+  int init_result;
+
+public:
+  gzip_decompressor()
+  {
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.next_in = Z_NULL;
+    stream.avail_in = 0;
+    // Only accept the gzip format.
+    init_result = inflateInit2(&stream, 16 + MAX_WBITS);
+  }
+
+  ~gzip_decompressor()
+  {
+    if (init_result == Z_OK)
+      inflateEnd(&stream);
+  }
+
+  bool decompress(const char* data, size_t size, export_parser& parser, std::string& error) override
+  {
+    if (init_result != Z_OK)
+    {
+      error = std::string("gzip: ") + zError(init_result);
+      return false;
+    }
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+
+    for (;;)
+    {
+      const auto buffer = parser.prepare(output_size);
+      stream.next_out = boost::asio::buffer_cast<Bytef*>(buffer);
+      stream.avail_out = static_cast<uInt>(output_size);
+
+      const int ret = inflate(&stream, Z_NO_FLUSH);
+      parser.commit(output_size - stream.avail_out);
+
+      if (ret == Z_STREAM_END)
+      {
+        // A gzip stream may consist of several members.
+        inflateReset(&stream);
+        if (stream.avail_in == 0)
+          return true;
+      }
+      else if (ret == Z_BUF_ERROR || (ret == Z_OK && stream.avail_in == 0 && stream.avail_out > 0))
+      {
+        return true;
+      }
+      else if (ret != Z_OK)
+      {
+        error = std::string("gzip: ") + (stream.msg != nullptr ? stream.msg : "corrupt data");
+        return false;
+      }
+    }
+  }
+};
+
+#ifdef HAVE_ZSTD
+class zstd_decompressor : public body_decompressor
+{
+  ZSTD_DStream* stream;
+
+public:
+  zstd_decompressor()
+    : stream(ZSTD_createDStream())
+  {
+    ZSTD_initDStream(stream);
+  }
+
+  ~zstd_decompressor()
+  {
+    ZSTD_freeDStream(stream);
+  }
+
+  bool decompress(const char* data, size_t size, export_parser& parser, std::string& error) override
+  {
+    ZSTD_inBuffer input = {data, size, 0};
+
+    for (;;)
+    {
+      const auto buffer = parser.prepare(output_size);
+      ZSTD_outBuffer output = {boost::asio::buffer_cast<char*>(buffer), output_size, 0};
+
+      const size_t ret = ZSTD_decompressStream(stream, &output, &input);
+      if (ZSTD_isError(ret))
+      {
+        error = std::string("zstd: ") + ZSTD_getErrorName(ret);
+        return false;
+      }
+      parser.commit(output.pos);
+
+      // A full output buffer may hold back more data.
+      if (input.pos == input.size && output.pos < output.size)
+        return true;
+    }
+  }
+};
+#endif
+}
+
+const char* accepted_encodings()
+{
+#ifdef HAVE_ZSTD
+  return "zstd, gzip";
+#else
+  return "gzip";
+#endif
+}
+
+bool http_response_header::parse(boost::string_view text, http_response_header& out, std::string& error)
+{
+  out = http_response_header();
+
+  size_t line_end = text.find('\n');
+  const boost::string_view status_line = trim(text.substr(0, line_end));
+
+  // "HTTP/1.1 200 OK"
+  if (!boost::algorithm::starts_with(status_line, "HTTP/1.") || status_line.size() < 12 || status_line[8] != ' ')
+  {
+    error = "Malformed status line '" + status_line.to_string() + "'";
+    return false;
+  }
+  const bool http_1_1 = status_line[7] != '0';
+  out.status = 0;
+  for (size_t i = 9; i < 12; ++i)
+  {
+    if (status_line[i] < '0' || status_line[i] > '9')
+    {
+      error = "Malformed status line '" + status_line.to_string() + "'";
+      return false;
+    }
+    out.status = out.status * 10 + (status_line[i] - '0');
+  }
+
+  bool connection_close = !http_1_1;
+
+  while (line_end != boost::string_view::npos)
+  {
+    text.remove_prefix(line_end + 1);
+    line_end = text.find('\n');
+    const boost::string_view line = trim(text.substr(0, line_end));
+    if (line.empty())
+      break;
+
+    const size_t colon = line.find(':');
+    if (colon == boost::string_view::npos)
+    {
+      error = "Malformed header field '" + line.to_string() + "'";
+      return false;
+    }
+
+    const boost::string_view name = trim(line.substr(0, colon));
+    const boost::string_view value = trim(line.substr(colon + 1));
+
+    if (boost::algorithm::iequals(name, "Transfer-Encoding"))
+    {
+      if (!boost::algorithm::iequals(value, "chunked"))
+      {
+        error = "Unsupported transfer encoding '" + value.to_string() + "'";
+        return false;
+      }
+      out.chunked = true;
+    }
+    else if (boost::algorithm::iequals(name, "Content-Encoding"))
+    {
+      if (boost::algorithm::iequals(value, "gzip") || boost::algorithm::iequals(value, "x-gzip"))
+        out.encoding = content_encoding::gzip;
+#ifdef HAVE_ZSTD
+      else if (boost::algorithm::iequals(value, "zstd"))
+        out.encoding = content_encoding::zstd;
+#endif
+      else if (value.empty() || boost::algorithm::iequals(value, "identity"))
+        out.encoding = content_encoding::identity;
+      else
+      {
+        error = "Unsupported content encoding '" + value.to_string() + "'";
+        return false;
+      }
+    }
+    else if (boost::algorithm::iequals(name, "Content-Length"))
+    {
+      int64_t length = 0;
+      for (char c : value)
+      {
+        if (c < '0' || c > '9' || length > INT64_MAX / 10 - 1)
+        {
+          error = "Malformed content length '" + value.to_string() + "'";
+          return false;
+        }
+        length = length * 10 + (c - '0');
+      }
+      out.content_length = length;
+    }
+    else if (boost::algorithm::iequals(name, "Connection"))
+    {
+      if (boost::algorithm::iequals(value, "close"))
+        connection_close = true;
+      else if (boost::algorithm::iequals(value, "keep-alive"))
+        connection_close = false;
+    }
+  }
+
+  // Chunked encoding takes precedence over a content length.
+  if (out.chunked)
+    out.content_length = -1;
+
+  // Without a delimited body the server closes the connection to end it.
+  out.keep_alive = !connection_close && (out.chunked || out.content_length >= 0);
+  return true;
+}
+
+http_body_decoder::http_body_decoder() = default;
+
+http_body_decoder::~http_body_decoder() = default;
+
+void http_body_decoder::reset(const http_response_header& header)
+{
+  this->header = header;
+  state = chunk_state::size;
+  chunk_remaining = 0;
+  body_remaining = header.content_length >= 0 ? static_cast<uint64_t>(header.content_length) : 0;
+  error_message.clear();
+
+  switch (header.encoding)
+  {
+    case content_encoding::identity:
+      inflater.reset();
+      break;
+    case content_encoding::gzip:
+      inflater = std::make_unique<gzip_decompressor>();
+      break;
+    case content_encoding::zstd:
+#ifdef HAVE_ZSTD
+      inflater = std::make_unique<zstd_decompressor>();
+#endif
+      break;
+  }
+}
+
+bool http_body_decoder::decode_content(const char* data, size_t size, export_parser& parser)
+{
+  if (!inflater)
+  {
+    parser.append(data, size);
+    return true;
+  }
+  return inflater->decompress(data, size, parser, error_message);
+}
+
+http_body_decoder::result http_body_decoder::decode(const char* data, size_t size, export_parser& parser)
+{
+  if (!header.chunked)
+  {
+    if (header.content_length < 0)
+      return decode_content(data, size, parser) ? result::more : result::error;
+
+    const size_t length = static_cast<size_t>(std::min<uint64_t>(size, body_remaining));
+    if (!decode_content(data, length, parser))
+      return result::error;
+    body_remaining -= length;
+    return body_remaining == 0 ? result::complete : result::more;
+  }
+
+  const char* const end = data + size;
+  while (data != end)
+  {
+    switch (state)
+    {
+      case chunk_state::size:
+        {
+          const int digit = hex_digit(*data);
+          if (digit >= 0)
+          {
+            if (chunk_remaining >> 60 != 0)
+            {
+              error_message = "Chunk size too large";
+              return result::error;
+            }
+            chunk_remaining = chunk_remaining * 16 + static_cast<uint64_t>(digit);
+          }
+          else if (*data == ';' || *data == ' ' || *data == '\t')
+            state = chunk_state::extension;
+          else if (*data == '\r')
+            state = chunk_state::size_end;
+          else if (*data == '\n')
+            state = chunk_remaining == 0 ? chunk_state::trailer : chunk_state::data;
+          else
+          {
+            error_message = "Malformed chunk size";
+            return result::error;
+          }
+          ++data;
+        }
+        break;
+      case chunk_state::extension:
+        if (*data == '\n')
+          state = chunk_remaining == 0 ? chunk_state::trailer : chunk_state::data;
+        ++data;
+        break;
+      case chunk_state::size_end:
+        if (*data != '\n')
+        {
+          error_message = "Malformed chunk size";
+          return result::error;
+        }
+        state = chunk_remaining == 0 ? chunk_state::trailer : chunk_state::data;
+        ++data;
+        break;
+      case chunk_state::data:
+        {
+          const size_t length = static_cast<size_t>(std::min<uint64_t>(end - data, chunk_remaining));
+          if (!decode_content(data, length, parser))
+            return result::error;
+          data += length;
+          chunk_remaining -= length;
+          if (chunk_remaining == 0)
+            state = chunk_state::data_end;
+        }
+        break;
+      case chunk_state::data_end:
+      case chunk_state::data_end_newline:
+        if (*data == '\r' && state == chunk_state::data_end)
+          state = chunk_state::data_end_newline;
+        else if (*data == '\n')
+          state = chunk_state::size;
+        else
+        {
+          error_message = "Missing line break after chunk";
+          return result::error;
+        }
+        ++data;
+        break;
+      case chunk_state::trailer:
+        // An empty line ends the trailer and the body.
+        if (*data == '\n')
+        {
+          state = chunk_state::done;
+          return result::complete;
+        }
+        if (*data != '\r')
+          state = chunk_state::trailer_line;
+        ++data;
+        break;
+      case chunk_state::trailer_line:
+        if (*data == '\n')
+          state = chunk_state::trailer;
+        ++data;
+        break;
+      case chunk_state::done:
+        return result::complete;
+    }
+  }
+
+  return state == chunk_state::done ? result::complete : result::more;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_view.hpp>
+
+#include "export_parser.h"
+
+enum class content_encoding
+{
+  identity,
+  gzip,
+  zstd
+};
+
+// The parts of an HTTP response header needed to read the body.
+struct http_response_header
+{
+  int status = 0;
+  bool chunked = false;
+  // -1 if the body ends when the connection is closed.
+  int64_t content_length = -1;
+  content_encoding encoding = content_encoding::identity;
+  // Whether another request may be sent on the connection afterwards.
+  bool keep_alive = false;
+
+  // Parses the status line and header fields up to the empty line. Returns
+  // false and sets error if they are malformed or use an unsupported
+  // encoding.
+  static bool parse(boost::string_view text, http_response_header& out, std::string& error);
+};
+
+class body_decompressor;
+
+// Value for the Accept-Encoding request header with all supported encodings.
+const char* accepted_encodings();
+
+// Removes the transfer and content encoding of a response body and passes
+// the result to an export_parser.
+class http_body_decoder
+{
+public:
+  enum class result
+  {
+    // All data was consumed and more is expected.
+    more,
+    // The body is complete. Remaining data is ignored.
+    complete,
+    error
+  };
+
+private:
+  enum class chunk_state
+  {
+    size,
+    extension,
+    size_end,
+    data,
+    data_end,
+    data_end_newline,
+    trailer,
+    trailer_line,
+    done
+  };
+
+  http_response_header header;
+  chunk_state state = chunk_state::size;
+  uint64_t chunk_remaining = 0;
+  uint64_t body_remaining = 0;
+  std::unique_ptr<body_decompressor> inflater;
+  std::string error_message;
+
+  bool decode_content(const char* data, size_t size, export_parser& parser);
+
+public:
+  http_body_decoder();
+  ~http_body_decoder();
+
+  // Prepares for the body of a response with the given header.
+  void reset(const http_response_header& header);
+
+  // Whether the body can be received directly into the parser, since it is
+  // neither encoded nor delimited.
+  bool passthrough() const
+  {
+    return !header.chunked && header.content_length < 0 && header.encoding == content_encoding::identity;
+  }
+
+  result decode(const char* data, size_t size, export_parser& parser);
+
+  const std::string& error() const
+  {
+    return error_message;
+  }
+};
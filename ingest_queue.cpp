@@ -0,0 +1,136 @@
+#include "ingest_queue.h"
+
+#include <thread>
+
+#include <boost/bind.hpp>
+
+#include "line_format.h"
+
+namespace
+{
+// Maximum number of entries passed on before other handlers get a chance to run.
+const size_t drain_batch_size = 1024;
+
+const int err = 3;
+}
+
+ingest_queue::ingest_queue(boost::asio::io_service& io_service, size_t capacity, metrics& stats, bool shed_load, size_t sources, entry_sink& next)
+  : io_service(io_service)
+  , next(next)
+  , queue(capacity)
+  , drain_scheduled(false)
+  , closed(false)
+  , queued(0)
+  , stats(stats)
+  , shed_load(shed_load)
+  , source_count(sources)
+  , sources(new source[sources])
+{
+}
+
+bool ingest_queue::shed(const journal_entry& entry)
+{
+  if (entry.source() >= source_count)
+    return false;
+
+  const size_t capacity = queue.capacity();
+  const size_t fill = queued.load(std::memory_order_relaxed);
+  if (fill < capacity / 2)
+    return false;
+
+  const int priority = entry_priority(entry);
+  if (priority <= err)
+    return false;
+
+  // Quiet sources keep their entries. Half of the share lets equally noisy
+  // sources still be shed, they can not all exceed their full share.
+  source& s = sources[entry.source()];
+  if (s.queued.load(std::memory_order_relaxed) <= capacity / source_count / 2)
+    return false;
+
+  // The fuller the queue, the more important entries are dropped.
+  const int min_priority = fill >= capacity / 8 * 7 ? 4 : fill >= capacity / 4 * 3 ? 5 : 7;
+  if (priority < min_priority)
+    return false;
+
+  if (s.stats == nullptr)
+    s.stats = stats.find_source(entry.source());
+  if (s.stats != nullptr)
+    s.stats->shed[priority].add(1);
+  return true;
+}
+
+void ingest_queue::add_line(const journal_entry& entry)
+{
+  if (shed_load && shed(entry))
+    return;
+
+  // Counted before the entry becomes visible to drain, which would
+  // otherwise be able to decrement the counts below zero.
+  queued.fetch_add(1, std::memory_order_relaxed);
+  if (entry.source() < source_count)
+    sources[entry.source()].queued.fetch_add(1, std::memory_order_relaxed);
+
+  while (!queue.try_push(entry))
+  {
+    if (closed.load(std::memory_order_relaxed))
+    {
+      // Nothing is taken out of the queue anymore, so the later entries of
+      // this source end up here as well and keep their order.
+      std::lock_guard<std::mutex> lock(overflow_mutex);
+      overflow.push_back(entry);
+      return;
+    }
+
+    std::this_thread::yield();
+  }
+
+  if (!drain_scheduled.exchange(true, std::memory_order_acq_rel))
+  {
+    io_service.post(boost::bind(&ingest_queue::drain, this));
+  }
+}
+
+void ingest_queue::drain()
+{
+  // Reset first, an entry pushed while draining will schedule another run.
+  drain_scheduled.store(false, std::memory_order_release);
+
+  size_t count = 0;
+  while (count < drain_batch_size && queue.try_pop([this](const journal_entry& entry) {
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    if (entry.source() < source_count)
+      sources[entry.source()].queued.fetch_sub(1, std::memory_order_relaxed);
+    next.add_line(entry);
+  }))
+  {
+    ++count;
+  }
+
+  if (count == drain_batch_size && !drain_scheduled.exchange(true, std::memory_order_acq_rel))
+  {
+    io_service.post(boost::bind(&ingest_queue::drain, this));
+  }
+}
+
+void ingest_queue::close()
+{
+  closed.store(true, std::memory_order_relaxed);
+}
+
+void ingest_queue::flush()
+{
+  while (queue.try_pop([this](const journal_entry& entry) { next.add_line(entry); }))
+  {
+  }
+
+  for (auto&& entry : overflow)
+    next.add_line(entry);
+  overflow.clear();
+
+  queued.store(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < source_count; ++i)
+    sources[i].queued.store(0, std::memory_order_relaxed);
+
+  next.flush();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "entry_sink.h"
+#include "metrics.h"
+#include "mpsc_queue.h"
+
+// Hands entries from reader threads over to the thread running io_service.
+//
+// add_line may be called from any thread. The entries are passed on to the
+// next sink on the thread of io_service. If the queue is full the calling
+// reader waits, which in turn stops it from reading its socket.
+//
+// With load shedding, entries of low priority are dropped instead once the
+// queue fills up: debug at half of the capacity, info and notice at three
+// quarters and warnings at seven eighths. Only sources with more than half
+// of their share of the capacity queued are shed, so a single noisy host
+// does not cost the others their entries. Errors and more important entries are
+// never dropped.
+class ingest_queue : public entry_sink
+{
+  struct source
+  {
+    std::atomic<size_t> queued{0};
+    // Set by the thread of the source on its first entry.
+    metrics::source* stats = nullptr;
+  };
+
+  boost::asio::io_service& io_service;
+  entry_sink& next;
+  mpsc_queue<journal_entry> queue;
+  std::atomic<bool> drain_scheduled;
+  std::atomic<bool> closed;
+  std::atomic<size_t> queued;
+  metrics& stats;
+  const bool shed_load;
+  const size_t source_count;
+  std::unique_ptr<source[]> sources;
+  // Entries which did not fit after close(), passed on by flush().
+  std::mutex overflow_mutex;
+  std::vector<journal_entry> overflow;
+
+  bool shed(const journal_entry& entry);
+  void drain();
+
+public:
+  // sources is the number of entry sources, whose ids are below it.
+  ingest_queue(boost::asio::io_service& io_service, size_t capacity, metrics& stats, bool shed_load, size_t sources, entry_sink& next);
+
+  void add_line(const journal_entry& entry) override;
+
+  // Number of entries waiting to be passed on.
+  size_t size() const
+  {
+    return queued.load(std::memory_order_relaxed);
+  }
+
+  // Keeps all further entries which do not fit aside instead of waiting
+  // for free space, so the readers can be stopped.
+  void close();
+
+  // Passes on the queued entries and those kept aside on the calling
+  // thread, once the readers are stopped.
+  void flush() override;
+};
@@ -0,0 +1,47 @@
+#include "io_service_pool.h"
+
+io_service_pool::io_service_pool(size_t size)
+{
+  for (size_t i = 0; i < size; ++i)
+  {
+    io_services.push_back(std::make_unique<boost::asio::io_service>(1));
+    works.push_back(std::make_unique<boost::asio::io_service::work>(*io_services.back()));
+  }
+}
+
+io_service_pool::~io_service_pool()
+{
+  stop();
+}
+
+boost::asio::io_service& io_service_pool::get_io_service()
+{
+  boost::asio::io_service& io_service = *io_services[next];
+  next = (next + 1) % io_services.size();
+  return io_service;
+}
+
+void io_service_pool::run()
+{
+  for (auto&& io_service : io_services)
+  {
+    threads.emplace_back([&io_service]() { io_service->run(); });
+  }
+}
+
+void io_service_pool::stop()
+{
+  works.clear();
+
+  for (auto&& io_service : io_services)
+  {
+    io_service->stop();
+  }
+
+  for (auto&& thread : threads)
+  {
+    thread.join();
+  }
+
+  threads.clear();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+// A set of io_services each run by its own thread.
+//
+// Every reader is bound to one io_service, so its handlers never run
+// concurrently and need no locking.
+class io_service_pool
+{
+  std::vector<std::unique_ptr<boost::asio::io_service>> io_services;
+  std::vector<std::unique_ptr<boost::asio::io_service::work>> works;
+  std::vector<std::thread> threads;
+  size_t next = 0;
+
+public:
+  explicit io_service_pool(size_t size);
+  ~io_service_pool();
+
+  // Returns the io_services in a round-robin fashion.
+  boost::asio::io_service& get_io_service();
+
+  void run();
+  void stop();
+};
@@ -0,0 +1,142 @@
+#include "journal_entry.h"
+#include "string_view_hash.h"
+#include "timestamp_formatter.h"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include <systemd/sd-journal.h>
+
+namespace
+{
+using field_index = std::unordered_map<boost::string_view, field_id, string_view_hash>;
+
+class field_table
+{
+  // A deque never moves its elements, so the keys of the index can point into it.
+  std::deque<std::string> names;
+  field_index index;
+  std::mutex mutex;
+  bool warned_full = false;
+
+public:
+  field_table()
+  {
+    // Must match the order of well_known_field.
+    for (auto name : {"__REALTIME_TIMESTAMP", "__CURSOR", "PRIORITY", "_HOSTNAME", "_COMM", "MESSAGE"})
+    {
+      intern(name);
+    }
+  }
+
+  field_id intern(boost::string_view name)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(name);
+    if (it != index.end())
+      return it->second;
+
+    if (names.size() >= field_names::overflow)
+    {
+      if (!warned_full)
+      {
+        sd_journal_print(LOG_WARNING, "More than %zu distinct field names, dropping fields with new names", names.size());
+        warned_full = true;
+      }
+      return field_names::overflow;
+    }
+
+    const field_id id = static_cast<field_id>(names.size());
+    names.emplace_back(name.data(), name.size());
+    index.emplace(names.back(), id);
+    return id;
+  }
+
+  boost::string_view name(field_id id)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return names[id];
+  }
+};
+
+field_table& table()
+{
+  static field_table instance;
+  return instance;
+}
+
+// Readers run on several threads. Each thread keeps its own copy of the
+// parts of the table it has seen so far and only locks the shared table for
+// names that are new to it.
+thread_local field_index local_index;
+thread_local std::vector<boost::string_view> local_names;
+}
+
+field_id field_names::intern(boost::string_view name)
+{
+  auto it = local_index.find(name);
+  if (it != local_index.end())
+    return it->second;
+
+  const field_id id = table().intern(name);
+  if (id == overflow)
+    return id;
+
+  local_index.emplace(field_names::name(id), id);
+  return id;
+}
+
+boost::string_view field_names::name(field_id id)
+{
+  if (id == overflow)
+    return boost::string_view();
+
+  if (id < local_names.size() && !local_names[id].empty())
+    return local_names[id];
+
+  if (id >= local_names.size())
+    local_names.resize(id + 1);
+
+  local_names[id] = table().name(id);
+  return local_names[id];
+}
+
+const field_id field_names::overflow;
+const uint16_t journal_entry::no_slot;
+
+journal_entry::journal_entry()
+{
+  slots.fill(no_slot);
+}
+
+void journal_entry::clear()
+{
+  arena.clear();
+  fields.clear();
+  slots.fill(no_slot);
+  repeat_count = 1;
+}
+
+void journal_entry::add(field_id id, boost::string_view value)
+{
+  if (id == field_names::overflow)
+    return;
+
+  if (id < slots.size())
+  {
+    slots[id] = static_cast<uint16_t>(fields.size());
+  }
+
+  fields.push_back(field{id, static_cast<uint32_t>(arena.size()), static_cast<uint32_t>(value.size())});
+  arena.append(value.data(), value.size());
+}
+
+uint64_t journal_entry::realtime_usec() const
+{
+  uint64_t result = 0;
+  if (!timestamp_formatter::parse(get(well_known_field::realtime_timestamp), result))
+    return 0;
+  return result;
+}
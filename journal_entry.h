@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_view.hpp>
+
+// Identifier of an interned field name.
+using field_id = uint16_t;
+
+// Fields which are needed for every entry. Their ids are fixed and each entry
+// keeps a slot for them, so they can be accessed without a lookup.
+enum class well_known_field : field_id
+{
+  realtime_timestamp,
+  cursor,
+  priority,
+  hostname,
+  comm,
+  message,
+  count
+};
+
+// Process wide table of field names. The same few dozen names repeat in every
+// entry, so they are stored once and entries only refer to them by id.
+class field_names
+{
+public:
+  // Returned by intern once the table holds as many names as ids fit into a
+  // field_id. Entries drop fields with this id.
+  static const field_id overflow = UINT16_MAX;
+
+  static field_id intern(boost::string_view name);
+  static boost::string_view name(field_id id);
+};
+
+// A single journal entry.
+//
+// All values are stored in one contiguous arena owned by the entry. Clearing
+// an entry keeps its capacity so it can be reused for the next one without
+// allocating.
+class journal_entry
+{
+  struct field
+  {
+    field_id id;
+    uint32_t value_begin;
+    uint32_t value_length;
+  };
+
+  static const uint16_t no_slot = UINT16_MAX;
+
+  std::string arena;
+  std::vector<field> fields;
+  std::array<uint16_t, static_cast<size_t>(well_known_field::count)> slots;
+  uint32_t source_id = 0;
+  uint32_t repeat_count = 1;
+
+public:
+  journal_entry();
+
+  void clear();
+
+  void add(field_id id, boost::string_view value);
+
+  void add(boost::string_view name, boost::string_view value)
+  {
+    add(field_names::intern(name), value);
+  }
+
+  bool has(well_known_field id) const
+  {
+    return slots[static_cast<size_t>(id)] != no_slot;
+  }
+
+  // Returns the value of the field or an empty string if it is not set.
+  boost::string_view get(well_known_field id) const
+  {
+    const uint16_t slot = slots[static_cast<size_t>(id)];
+    if (slot == no_slot)
+      return boost::string_view();
+    return value(fields[slot]);
+  }
+
+  size_t size() const
+  {
+    return fields.size();
+  }
+
+  // Identifies the reader the entry was received from.
+  uint32_t source() const
+  {
+    return source_id;
+  }
+
+  void set_source(uint32_t source)
+  {
+    source_id = source;
+  }
+
+  // Number of times the entry was received, set when repeats were collapsed
+  // into this one.
+  uint32_t repeats() const
+  {
+    return repeat_count;
+  }
+
+  void set_repeats(uint32_t repeats)
+  {
+    repeat_count = repeats;
+  }
+
+  // Returns __REALTIME_TIMESTAMP in microseconds or 0 if it is missing or malformed.
+  uint64_t realtime_usec() const;
+
+  // Calls f(name, value) for each field in the order they were added.
+  template<typename F>
+  void for_each(F&& f) const
+  {
+    for (auto&& field : fields)
+    {
+      f(field_names::name(field.id), value(field));
+    }
+  }
+
+private:
+  boost::string_view value(const field& field) const
+  {
+    return boost::string_view(arena.data() + field.value_begin, field.value_length);
+  }
+};
@@ -0,0 +1,87 @@
+#include "journal_filter.h"
+
+#include <stdexcept>
+
+namespace
+{
+const char* const priority_names[] = {"emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"};
+
+void append_escaped(std::string& out, const std::string& value)
+{
+  static const char hex[] = "0123456789ABCDEF";
+
+  for (unsigned char c : value)
+  {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' || c == '~')
+    {
+      out += c;
+    }
+    else
+    {
+      out += '%';
+      out += hex[c >> 4];
+      out += hex[c & 0xf];
+    }
+  }
+}
+}
+
+void journal_filter::add_match(const std::string& match)
+{
+  const auto pos = match.find('=');
+  if (pos == std::string::npos || pos == 0)
+  {
+    throw std::invalid_argument("Invalid match '" + match + "', expected FIELD=value");
+  }
+
+  field_matches.push_back(match);
+}
+
+void journal_filter::add_match(const std::string& field, const std::string& value)
+{
+  field_matches.push_back(field + "=" + value);
+}
+
+void journal_filter::set_max_priority(const std::string& priority)
+{
+  int max = -1;
+
+  if (priority.size() == 1 && priority[0] >= '0' && priority[0] <= '7')
+  {
+    max = priority[0] - '0';
+  }
+  else
+  {
+    for (int i = 0; i < 8; ++i)
+    {
+      if (priority == priority_names[i])
+        max = i;
+    }
+  }
+
+  if (max < 0)
+  {
+    throw std::invalid_argument("Unknown priority '" + priority + "'");
+  }
+
+  for (int i = 0; i <= max; ++i)
+  {
+    add_match("PRIORITY", std::to_string(i));
+  }
+}
+
+std::string journal_filter::query_string() const
+{
+  std::string result;
+
+  for (auto&& match : field_matches)
+  {
+    const auto pos = match.find('=');
+    result += '&';
+    append_escaped(result, match.substr(0, pos));
+    result += '=';
+    append_escaped(result, match.substr(pos + 1));
+  }
+
+  return result;
+}
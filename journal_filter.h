@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Matches restricting which entries are read, in the form FIELD=value.
+//
+// They are applied by the sources themselves, so filtered out entries are
+// neither transferred nor parsed. As with sd_journal_add_match() matches for
+// the same field are combined with OR and matches for different fields with
+// AND.
+class journal_filter
+{
+  std::vector<std::string> field_matches;
+
+public:
+  // Throws std::invalid_argument if match is not of the form FIELD=value.
+  void add_match(const std::string& match);
+
+  void add_match(const std::string& field, const std::string& value);
+
+  // Only lets entries with the given priority or a more important one pass.
+  // Accepts a number or a name like "err". Throws std::invalid_argument for
+  // unknown priorities.
+  void set_max_priority(const std::string& priority);
+
+  const std::vector<std::string>& matches() const
+  {
+    return field_matches;
+  }
+
+  // Returns the matches as URL query parameters, each preceded by '&'.
+  std::string query_string() const;
+};
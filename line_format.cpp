@@ -0,0 +1,207 @@
+#include "line_format.h"
+
+#include "byte_scan.h"
+#include "timestamp_formatter.h"
+
+namespace
+{
+const int notice = 5;
+
+const char hex[] = "0123456789abcdef";
+
+// Returns the length of the valid UTF-8 sequence starting with a byte of at
+// least 0x80 at pos, 0 if it is invalid.
+size_t utf8_sequence_length(const char* pos, const char* end)
+{
+  const unsigned char lead = static_cast<unsigned char>(*pos);
+  size_t length;
+  uint32_t min;
+  uint32_t code_point;
+  if ((lead & 0xe0) == 0xc0)
+  {
+    length = 2;
+    min = 0x80;
+    code_point = lead & 0x1f;
+  }
+  else if ((lead & 0xf0) == 0xe0)
+  {
+    length = 3;
+    min = 0x800;
+    code_point = lead & 0x0f;
+  }
+  else if ((lead & 0xf8) == 0xf0)
+  {
+    length = 4;
+    min = 0x10000;
+    code_point = lead & 0x07;
+  }
+  else
+  {
+    return 0;
+  }
+
+  if (static_cast<size_t>(end - pos) < length)
+    return 0;
+
+  for (size_t i = 1; i < length; ++i)
+  {
+    const unsigned char c = static_cast<unsigned char>(pos[i]);
+    if ((c & 0xc0) != 0x80)
+      return 0;
+    code_point = (code_point << 6) | (c & 0x3f);
+  }
+
+  // Overlong forms, surrogates and values beyond Unicode are invalid.
+  if (code_point < min || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+    return 0;
+  return length;
+}
+
+void append_hex_escape(std::string& out, unsigned char c)
+{
+  out += "\\u00";
+  out += hex[c >> 4];
+  out += hex[c & 0xf];
+}
+
+// Returns false on the first byte which is not valid UTF-8, unless it may
+// be escaped.
+bool append_quoted(std::string& out, boost::string_view value, bool escape_invalid)
+{
+  out += '"';
+  const char* pos = value.data();
+  const char* const end = value.data() + value.size();
+  for (;;)
+  {
+    // Bytes which need no escaping are copied in one go.
+    const char* special = find_json_special(pos, end);
+    out.append(pos, special - pos);
+    if (special == end)
+      break;
+
+    const char c = *special;
+    pos = special + 1;
+    if (static_cast<unsigned char>(c) >= 0x80)
+    {
+      const size_t length = utf8_sequence_length(special, end);
+      if (length > 0)
+      {
+        out.append(special, length);
+        pos = special + length;
+      }
+      else if (escape_invalid)
+      {
+        append_hex_escape(out, static_cast<unsigned char>(c));
+      }
+      else
+      {
+        return false;
+      }
+      continue;
+    }
+
+    switch (c)
+    {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        append_hex_escape(out, static_cast<unsigned char>(c));
+    }
+  }
+  out += '"';
+  return true;
+}
+}
+
+int entry_priority(const journal_entry& entry)
+{
+  const boost::string_view priority = entry.get(well_known_field::priority);
+  if (priority.size() == 1 && priority[0] >= '0' && priority[0] <= '7')
+  {
+    return priority[0] - '0';
+  }
+  return notice;
+}
+
+void format_line(const journal_entry& entry, std::string& out)
+{
+  // format_line() may be called from several threads.
+  static thread_local timestamp_formatter timestamps;
+
+  boost::string_view machine = "<none>";
+  if (entry.has(well_known_field::hostname))
+    machine = entry.get(well_known_field::hostname);
+
+  boost::string_view process = "kernel";
+  if (entry.has(well_known_field::comm))
+    process = entry.get(well_known_field::comm);
+
+  boost::string_view message = "<none>";
+  if (entry.has(well_known_field::message))
+    message = entry.get(well_known_field::message);
+
+  uint64_t timestamp;
+  if (timestamp_formatter::parse(entry.get(well_known_field::realtime_timestamp), timestamp))
+    timestamps.append(timestamp, out);
+  else
+    out += "not-a-date-time";
+  out += ' ';
+  out.append(machine.data(), machine.size());
+  out += ' ';
+  out.append(process.data(), process.size());
+  out += ": ";
+
+  // Multi-line messages are kept on one line.
+  const char* const end = message.data() + message.size();
+  for (const char* pos = message.data(); pos != end;)
+  {
+    const char* newline = find_line_end(pos, end, nullptr);
+    out.append(pos, newline);
+    if (newline == end)
+      break;
+    out += "\\n";
+    pos = newline + 1;
+  }
+}
+
+void append_repeats(const journal_entry& entry, std::string& out)
+{
+  if (entry.repeats() <= 1)
+    return;
+
+  out += " (\u00d7";
+  out += std::to_string(entry.repeats());
+  out += ')';
+}
+
+void append_json_string(std::string& out, boost::string_view value)
+{
+  append_quoted(out, value, true);
+}
+
+void append_json_value(std::string& out, boost::string_view value)
+{
+  const size_t start = out.size();
+  if (append_quoted(out, value, false))
+    return;
+
+  out.resize(start);
+  out += '[';
+  for (size_t i = 0; i < value.size(); ++i)
+  {
+    if (i != 0)
+      out += ',';
+    out += std::to_string(static_cast<unsigned char>(value[i]));
+  }
+  out += ']';
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "journal_entry.h"
+
+// Returns the PRIORITY of the entry, or notice if it is missing or invalid.
+int entry_priority(const journal_entry& entry);
+
+// Appends the entry as it is displayed: "HH:MM:SS host process: message".
+void format_line(const journal_entry& entry, std::string& out);
+
+// Appends " (×N)" if the entry stands for N > 1 collapsed repeats.
+void append_repeats(const journal_entry& entry, std::string& out);
+
+// Appends value as a quoted JSON string. Bytes which are not part of valid
+// UTF-8 are escaped as \u00XX, so the output is always valid JSON.
+void append_json_string(std::string& out, boost::string_view value);
+
+// Appends value like journalctl -o json does: as a JSON string if it is
+// valid UTF-8, otherwise as an array of its bytes.
+void append_json_value(std::string& out, boost::string_view value);
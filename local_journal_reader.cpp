@@ -1,5 +1,7 @@
 #include "local_journal_reader.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
 #include <boost/format.hpp>
@@ -10,23 +12,55 @@ local_journal_reader::call_error::call_error(const std::string& function, int er
 {
 }
 
-local_journal_reader::local_journal_reader(boost::asio::io_service& io_service, const std::string& cursor_path, outputter& out)
-  : out(out)
+local_journal_reader::local_journal_reader(boost::asio::io_service& io_service, checkpoint_manager& checkpoints, metrics& stats, const std::string& directory, const journal_filter& filter, const std::vector<std::string>& projection, size_t batch_entries, std::chrono::steady_clock::duration batch_time, entry_sink& out)
+  : io_service(io_service)
+  , out(out)
+  , checkpoints(checkpoints)
+  , checkpoint(checkpoints.add_source("local"))
+  , source_metrics(stats.add_source("local"))
+  , project(!projection.empty())
+  , batch_entries(std::max<size_t>(batch_entries, 1))
+  , batch_time(batch_time)
 {
-  const std::string file_path = cursor_path + "/local";
-  file.open(file_path, std::fstream::in | std::fstream::out);
-  if (file.fail())
+  entry.set_source(checkpoint);
+
+  for (auto&& name : projection)
   {
-    file.open(file_path, std::fstream::in | std::fstream::out | std::fstream::trunc);
+    // Address fields like __CURSOR are not stored as data.
+    if (name.compare(0, 2, "__") != 0)
+    {
+      projected_fields.emplace_back(name, field_names::intern(name));
+    }
   }
 
-  file >> cursor;
+  int error_code;
+  if (directory.empty())
+  {
+    error_code = sd_journal_open(&journal, SD_JOURNAL_LOCAL_ONLY);
 
-  int error_code = sd_journal_open(&journal, SD_JOURNAL_LOCAL_ONLY);
+    if (error_code != 0)
+    {
+      throw call_error("sd_journal_open", -error_code);
+    }
+  }
+  else
+  {
+    error_code = sd_journal_open_directory(&journal, directory.c_str(), 0);
 
-  if (error_code != 0)
+    if (error_code != 0)
+    {
+      throw call_error("sd_journal_open_directory", -error_code);
+    }
+  }
+
+  for (auto&& match : filter.matches())
   {
-    throw call_error("sd_journal_open", error_code);
+    error_code = sd_journal_add_match(journal, match.data(), match.size());
+
+    if (error_code != 0)
+    {
+      throw call_error("sd_journal_add_match", -error_code);
+    }
   }
 
   int fd = sd_journal_get_fd(journal);
@@ -36,19 +70,16 @@ local_journal_reader::local_journal_reader(boost::asio::io_service& io_service,
     throw call_error("sd_journal_get_fd", error_code);
   }
 
-  if (!cursor.empty())
+  last_cursor = checkpoints.cursor(checkpoint);
+  if (!last_cursor.empty())
   {
-    error_code = sd_journal_seek_cursor(journal, cursor.c_str());
-
-    if (error_code != 0)
-    {
-      sd_journal_print(LOG_WARNING, "Error calling seeking to last cursor: %s", strerror(error_code));
-    }
+    seek_after(last_cursor);
   }
 
   journal_descriptor = std::make_unique<boost::asio::posix::stream_descriptor>(io_service, fd);
 
-  read_journal();
+  // Read the backlog on the thread of io_service rather than the constructing one.
+  schedule_read();
   async_read();
 }
 
@@ -57,50 +88,124 @@ local_journal_reader::~local_journal_reader()
   sd_journal_close(journal);
 }
 
-void local_journal_reader::update_cursor(const std::string& cursor)
+void local_journal_reader::read_fields()
+{
+  const void* data;
+  size_t length;
+
+  if (project)
+  {
+    for (auto&& field : projected_fields)
+    {
+      if (sd_journal_get_data(journal, field.first.c_str(), &data, &length) == 0)
+      {
+        boost::string_view line(static_cast<const char*>(data), length);
+        entry.add(field.second, line.substr(field.first.size() + 1));
+      }
+    }
+    return;
+  }
+
+  SD_JOURNAL_FOREACH_DATA(journal, data, length) {
+    boost::string_view line(static_cast<const char*>(data), length);
+    auto equal_pos = line.find('=');
+    if (equal_pos == boost::string_view::npos)
+      continue;
+
+    entry.add(line.substr(0, equal_pos), line.substr(equal_pos+1));
+  }
+}
+
+void local_journal_reader::seek_after(const std::string& cursor)
+{
+  int error_code = sd_journal_seek_cursor(journal, cursor.c_str());
+
+  if (error_code != 0)
+  {
+    sd_journal_print(LOG_WARNING, "Error seeking to last cursor: %s", strerror(-error_code));
+    return;
+  }
+
+  // Seeking only takes effect with the next move, which lands on the entry
+  // of the cursor or the first one after it if it was removed.
+  error_code = sd_journal_next(journal);
+
+  if (error_code < 0)
+  {
+    sd_journal_print(LOG_WARNING, "Error calling sd_journal_next: %s", strerror(-error_code));
+  }
+  else if (error_code == 1 && sd_journal_test_cursor(journal, cursor.c_str()) <= 0)
+  {
+    // This entry has not been read yet, so step back in front of it.
+    if (sd_journal_previous(journal) != 1)
+    {
+      sd_journal_seek_head(journal);
+    }
+  }
+}
+
+void local_journal_reader::schedule_read()
 {
-  this->cursor = cursor;
-  file.clear();
-  file.seekp(0);
-  file << cursor;
-  file.flush();
+  read_scheduled = true;
+  io_service.post(boost::bind(&local_journal_reader::read_journal, this));
 }
 
 void local_journal_reader::read_journal()
 {
-  int error_code;
+  read_scheduled = false;
 
-  while ((error_code = sd_journal_next(journal)) == 1)
-  {
-    std::map<std::string, std::string> values;
-    const void* data;
-    size_t length;
-    SD_JOURNAL_FOREACH_DATA(journal, data, length) {
-      std::string line(static_cast<const char*>(data), length);
-      auto equal_pos = line.find('=');
-      if (equal_pos == std::string::npos)
-        continue;
+  int error_code = 0;
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t usec = 0;
+  size_t entries = 0;
+  bool more = false;
 
-      values[line.substr(0, equal_pos)] = line.substr(equal_pos+1);
+  for (;;)
+  {
+    // Reading the clock for every entry would cost more than small entries.
+    if (entries == batch_entries || (entries % 64 == 63 && std::chrono::steady_clock::now() - start >= batch_time))
+    {
+      more = true;
+      break;
     }
 
-    uint64_t usec;
+    if ((error_code = sd_journal_next(journal)) != 1)
+      break;
+
+    entry.clear();
+    read_fields();
+
     sd_journal_get_realtime_usec(journal, &usec);
-    values["__REALTIME_TIMESTAMP"] = std::to_string(usec);
+    entry.add(static_cast<field_id>(well_known_field::realtime_timestamp), std::to_string(usec));
+
+    ++entries;
+    out.add_line(entry);
+  }
 
+  if (entries > 0)
+  {
+    // Still positioned at the last entry read.
+    char* cursor;
+    if (sd_journal_get_cursor(journal, &cursor) == 0)
     {
-      char* cursor;
-      sd_journal_get_cursor(journal, &cursor);
-      update_cursor(cursor);
+      last_cursor = cursor;
+      checkpoints.update(checkpoint, last_cursor);
       free(cursor);
     }
 
-    out.add_line(values);
+    source_metrics.entries.add(entries);
+    source_metrics.parse_latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    source_metrics.received(usec);
   }
 
   if (error_code < 0)
   {
-    sd_journal_print(LOG_WARNING, "Error calling sd_journal_next: %s", strerror(error_code));
+    sd_journal_print(LOG_WARNING, "Error calling sd_journal_next: %s", strerror(-error_code));
+  }
+
+  if (more)
+  {
+    schedule_read();
   }
 }
 
@@ -119,10 +224,15 @@ void local_journal_reader::on_data_available(boost::system::error_code ec)
       case SD_JOURNAL_NOP:
         break;
       case SD_JOURNAL_APPEND:
-        read_journal();
+        if (!read_scheduled)
+          read_journal();
         break;
       case SD_JOURNAL_INVALIDATE:
-        //TODO: How to handle?
+        // The file the journal is positioned in may be gone.
+        if (!last_cursor.empty())
+          seek_after(last_cursor);
+        if (!read_scheduled)
+          read_journal();
         break;
       default:
         sd_journal_print(LOG_WARNING, "Unexpected return code from sd_journal_process: %i", error_code);
@@ -1,25 +1,53 @@
 #pragma once
 
-#include <fstream>
 #include <string.h>
 
+#include <chrono>
+
 #include <boost/asio.hpp>
 
 #include <systemd/sd-journal.h>
 
-#include "outputter.h"
+#include "checkpoint_manager.h"
+#include "entry_sink.h"
+#include "journal_filter.h"
+#include "metrics.h"
 
+// Follows the journal of the local machine.
+//
+// Entries are read in batches of at most batch_entries entries or
+// batch_time, whichever ends first. The cursor is only fetched once per
+// batch, and the next batch is posted to io_service so the handlers of
+// other sources sharing it get their turn in between.
+//
+// When journal files are added or removed, e.g. by rotation or vacuuming,
+// the journal is positioned again after the last entry read. Nothing is
+// read twice, and entries in new files are not missed.
 class local_journal_reader
 {
+  boost::asio::io_service& io_service;
   sd_journal* journal;
-  outputter& out;
-  std::fstream file;
-  std::string cursor;
+  entry_sink& out;
+  checkpoint_manager& checkpoints;
+  checkpoint_manager::source_id checkpoint;
+  metrics::source& source_metrics;
+  journal_entry entry;
+  bool project;
+  // Names and ids of the data fields read when projecting.
+  std::vector<std::pair<std::string, field_id>> projected_fields;
   std::unique_ptr<boost::asio::posix::stream_descriptor> journal_descriptor;
+  const size_t batch_entries;
+  const std::chrono::steady_clock::duration batch_time;
+  // A batch has been posted and will read whatever was appended meanwhile.
+  bool read_scheduled = false;
+  // Cursor of the last entry read, empty if none.
+  std::string last_cursor;
 
-  void update_cursor(const std::string& cursor);
   void on_data_available(boost::system::error_code ec);
+  void read_fields();
   void read_journal();
+  void schedule_read();
+  void seek_after(const std::string& cursor);
   void async_read();
 
 public:
@@ -30,6 +58,8 @@ public:
     call_error(const std::string& function, int error_code);
   };
 
-  local_journal_reader(boost::asio::io_service& io_service, const std::string& cursor_path, outputter& out);
+  // Reads the journal files in directory, or those of the local machine if
+  // it is empty.
+  local_journal_reader(boost::asio::io_service& io_service, checkpoint_manager& checkpoints, metrics& stats, const std::string& directory, const journal_filter& filter, const std::vector<std::string>& projection, size_t batch_entries, std::chrono::steady_clock::duration batch_time, entry_sink& out);
   ~local_journal_reader();
 };
@@ -1,19 +1,64 @@
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
 
+#include <chrono>
+#include <csignal>
 #include <iostream>
 #include <string>
+#include <system_error>
 
+#include "checkpoint_manager.h"
+#include "dedup_stage.h"
+#include "entry_spool.h"
+#include "ingest_queue.h"
+#include "journal_filter.h"
+#include "io_service_pool.h"
 #include "ncurses.h"
+#include "reconnect_scheduler.h"
 #include "remote_journal_reader.h"
 #include "local_journal_reader.h"
+#include "merge_stage.h"
+#include "metrics.h"
+#include "metrics_exporter.h"
 #include "outputter.h"
+#include "stream_outputter.h"
+#include "worker_process.h"
+#include "worker_sink.h"
 
 int main(int argc, char** argv)
 {
   std::string cursor_path(".");
   std::vector<std::string> remote_hosts;
   bool use_local_journal = false;
+  std::string journal_directory;
+  long checkpoint_interval = 1000;
+  size_t checkpoint_entries = 1000;
+  long reconnect_delay = 1000;
+  long reconnect_max_delay = 60000;
+  size_t max_connecting = 16;
+  size_t reader_threads = 0;
+  size_t queue_size = 65536;
+  size_t worker_count = 0;
+  size_t worker_shard = 0;
+  int worker_fd = -1;
+  bool load_shedding = false;
+  unsigned frame_rate = 30;
+  size_t scrollback_size = 64;
+  long reorder_window = 0;
+  long dedup_window = 0;
+  size_t catch_up_chunk = 10000;
+  size_t local_batch_entries = 1024;
+  long local_batch_time = 5;
+  journal_filter filter;
+  std::vector<std::string> projection;
+  std::string output("ncurses");
+  std::string output_file("-");
+  std::string spool_directory;
+  size_t spool_size = 1024;
+  long spool_replay = 10;
+  std::string metrics_file;
+  std::string metrics_socket;
+  long metrics_interval = 10000;
 
   {
     namespace po = boost::program_options;
@@ -22,12 +67,44 @@ int main(int argc, char** argv)
     description.add_options()
       ("help,h", "print this help message")
       ("local,l", "read from the local systemd journal")
-      ("cursor-path,c", po::value<std::string>()->value_name("path")->default_value(cursor_path), "path where the current read position for each remote host is stored");
+      ("directory,D", po::value<std::string>()->value_name("path"), "read the journal files in this directory instead of those of the local machine, implies --local")
+      ("cursor-path,c", po::value<std::string>()->value_name("path")->default_value(cursor_path), "path where the current read position for each remote host is stored")
+      ("checkpoint-interval", po::value<long>()->value_name("ms")->default_value(checkpoint_interval), "maximum time until a new read position is stored")
+      ("checkpoint-entries", po::value<size_t>()->value_name("count")->default_value(checkpoint_entries), "maximum number of entries read until a new read position is stored")
+      ("reconnect-delay", po::value<long>()->value_name("ms")->default_value(reconnect_delay), "time until a remote host is contacted again after the first failure, doubled with every further failure")
+      ("reconnect-max-delay", po::value<long>()->value_name("ms")->default_value(reconnect_max_delay), "maximum time until a remote host is contacted again after a failure")
+      ("max-connecting", po::value<size_t>()->value_name("count")->default_value(max_connecting), "maximum number of remote hosts which are connected to at the same time")
+      ("priority,p", po::value<std::string>()->value_name("priority"), "only show entries with this priority or a more important one")
+      ("unit,u", po::value<std::vector<std::string>>()->value_name("unit"), "only show entries of this systemd unit, may be given multiple times")
+      ("comm", po::value<std::vector<std::string>>()->value_name("name"), "only show entries of processes with this name, may be given multiple times")
+      ("match,m", po::value<std::vector<std::string>>()->value_name("FIELD=value"), "only show entries where the field has this value, may be given multiple times")
+      ("all-fields", "read all fields of each entry instead of only those which are shown")
+      ("output,o", po::value<std::string>()->value_name("format")->default_value(output), "ncurses shows the entries on the terminal, text and json write lines to the output file")
+      ("output-file", po::value<std::string>()->value_name("path")->default_value(output_file), "file the text and json output is appended to, - for stdout")
+      ("frame-rate", po::value<unsigned>()->value_name("hz")->default_value(frame_rate), "maximum number of screen updates per second")
+      ("scrollback-size", po::value<size_t>()->value_name("MiB")->default_value(scrollback_size), "memory used to keep lines for scrolling back and searching, 0 disables it")
+      ("dedup-window", po::value<long>()->value_name("ms")->default_value(dedup_window), "collapse repeats of a message from the same host and process within this time into one line with a repeat count; 0 shows every repeat")
+      ("reorder-window", po::value<long>()->value_name("ms")->default_value(reorder_window), "show entries of all hosts ordered by time, delaying them up to this long; 0 shows them as they arrive")
+      ("spool", po::value<std::string>()->value_name("path"), "directory where received entries are stored before they are shown, so reading never waits for the display and recent entries are shown again after a restart")
+      ("spool-size", po::value<size_t>()->value_name("MiB")->default_value(spool_size), "disk space used by the spool")
+      ("spool-replay", po::value<long>()->value_name("minutes")->default_value(spool_replay), "entries from the spool received this long ago are shown again on start")
+      ("metrics-file", po::value<std::string>()->value_name("path"), "file the metrics of each source and the display are written to periodically")
+      ("metrics-socket", po::value<std::string>()->value_name("path"), "Unix socket which sends the current metrics to every client connecting")
+      ("metrics-interval", po::value<long>()->value_name("ms")->default_value(metrics_interval), "time between updates of the metrics file")
+      ("catch-up-chunk", po::value<size_t>()->value_name("entries")->default_value(catch_up_chunk), "entries requested at once while fetching the backlog of a remote host after a restart, 0 follows it right away")
+      ("local-batch-entries", po::value<size_t>()->value_name("count")->default_value(local_batch_entries), "maximum number of entries read from the local journal before other sources get a turn")
+      ("local-batch-time", po::value<long>()->value_name("ms")->default_value(local_batch_time), "maximum time spent reading the local journal before other sources get a turn")
+      ("threads,t", po::value<size_t>()->value_name("count")->default_value(reader_threads), "number of threads reading and parsing entries, 0 reads them on the display thread")
+      ("queue-size", po::value<size_t>()->value_name("entries")->default_value(queue_size), "maximum number of entries read ahead of the display when using reader threads")
+      ("load-shedding", "drop entries of low priority from noisy hosts when the reader threads get ahead of the display, instead of slowing down all hosts")
+      ("workers,w", po::value<size_t>()->value_name("count")->default_value(worker_count), "number of processes the sources are distributed over, each with its own readers and threads; 0 reads them in this process");
 
     po::options_description hidden("Hidden options");
     hidden.add(description);
     hidden.add_options()
-      ("remote-hosts", po::value<std::vector<std::string>>(), "remote hosts to connect to");
+      ("remote-hosts", po::value<std::vector<std::string>>(), "remote hosts to connect to")
+      ("worker-shard", po::value<size_t>(), "share of the sources read by this worker process")
+      ("worker-fd", po::value<int>(), "socket the entries of this worker process are passed on to");
 
     po::positional_options_description positionals;
     positionals.add("remote-hosts", -1);
@@ -53,43 +130,271 @@ int main(int argc, char** argv)
       return 1;
     }
 
-    if (vm.count("remote-hosts") == 0 && vm.count("local") == 0)
+    if (vm.count("remote-hosts") == 0 && vm.count("local") == 0 && vm.count("directory") == 0)
     {
       std::cout << "At least one remote host or the local journal must be specified.\n";
       return 1;
     }
 
     cursor_path = vm["cursor-path"].as<std::string>();
+    checkpoint_interval = vm["checkpoint-interval"].as<long>();
+    checkpoint_entries = vm["checkpoint-entries"].as<size_t>();
+    reconnect_delay = vm["reconnect-delay"].as<long>();
+    reconnect_max_delay = vm["reconnect-max-delay"].as<long>();
+    max_connecting = vm["max-connecting"].as<size_t>();
+    frame_rate = std::max(vm["frame-rate"].as<unsigned>(), 1u);
+    scrollback_size = vm["scrollback-size"].as<size_t>();
+    reorder_window = vm["reorder-window"].as<long>();
+    dedup_window = vm["dedup-window"].as<long>();
+    catch_up_chunk = vm["catch-up-chunk"].as<size_t>();
+    local_batch_entries = vm["local-batch-entries"].as<size_t>();
+    local_batch_time = vm["local-batch-time"].as<long>();
+    output = vm["output"].as<std::string>();
+    output_file = vm["output-file"].as<std::string>();
+    if (vm.count("spool"))
+      spool_directory = vm["spool"].as<std::string>();
+    spool_size = vm["spool-size"].as<size_t>();
+    spool_replay = vm["spool-replay"].as<long>();
+    if (vm.count("metrics-file"))
+      metrics_file = vm["metrics-file"].as<std::string>();
+    if (vm.count("metrics-socket"))
+      metrics_socket = vm["metrics-socket"].as<std::string>();
+    metrics_interval = std::max(vm["metrics-interval"].as<long>(), 1l);
+
+    if (output != "ncurses" && output != "text" && output != "json")
+    {
+      std::cerr << "Unknown output format '" << output << "'\n";
+      return 1;
+    }
+
+    if (vm.count("all-fields") == 0)
+    {
+      for (field_id id = 0; id < static_cast<field_id>(well_known_field::count); ++id)
+      {
+        projection.push_back(field_names::name(id).to_string());
+      }
+    }
+
+    try
+    {
+      if (vm.count("priority"))
+      {
+        filter.set_max_priority(vm["priority"].as<std::string>());
+      }
+      if (vm.count("unit"))
+      {
+        for (auto&& unit : vm["unit"].as<std::vector<std::string>>())
+          filter.add_match("_SYSTEMD_UNIT", unit);
+      }
+      if (vm.count("comm"))
+      {
+        for (auto&& comm : vm["comm"].as<std::vector<std::string>>())
+          filter.add_match("_COMM", comm);
+      }
+      if (vm.count("match"))
+      {
+        for (auto&& match : vm["match"].as<std::vector<std::string>>())
+          filter.add_match(match);
+      }
+    } catch (const std::invalid_argument& e)
+    {
+      std::cerr << e.what() << '\n';
+      return 1;
+    }
+
+    reader_threads = vm["threads"].as<size_t>();
+    queue_size = vm["queue-size"].as<size_t>();
+    load_shedding = vm.count("load-shedding") > 0;
 
     if (vm.count("remote-hosts") > 0)
     {
       remote_hosts = vm["remote-hosts"].as<std::vector<std::string>>();
     }
-    use_local_journal = vm.count("local") > 0;
+    use_local_journal = vm.count("local") > 0 || vm.count("directory") > 0;
+    if (vm.count("directory"))
+      journal_directory = vm["directory"].as<std::string>();
+
+    worker_count = vm["workers"].as<size_t>();
+    // Only the queue of the reader threads sheds, the spool takes its place,
+    // and the workers' shed counts would not reach the metrics of this
+    // process.
+    if (load_shedding && (reader_threads == 0 || worker_count > 0 || !spool_directory.empty()) && vm.count("worker-fd") == 0)
+    {
+      std::cerr << "--load-shedding needs reader threads (-t) and can not be used with --workers or --spool\n";
+      return 1;
+    }
+
+    if (vm.count("worker-fd"))
+    {
+      // Started by worker_process: read every worker_count-th host, the
+      // first worker also the local journal, and pass the entries on.
+      worker_fd = vm["worker-fd"].as<int>();
+      worker_shard = vm.count("worker-shard") ? vm["worker-shard"].as<size_t>() : 0;
+      std::vector<std::string> shard_hosts;
+      for (size_t i = worker_shard; i < remote_hosts.size(); i += std::max<size_t>(worker_count, 1))
+        shard_hosts.push_back(remote_hosts[i]);
+      remote_hosts = shard_hosts;
+      use_local_journal = use_local_journal && worker_shard == 0;
+      output = "worker";
+      reorder_window = 0;
+      dedup_window = 0;
+      spool_directory.clear();
+      metrics_file.clear();
+      metrics_socket.clear();
+    }
+    else if (worker_count > 0)
+    {
+      // The threads are the workers' business.
+      reader_threads = 0;
+    }
+  }
+
+  std::unique_ptr<ncurses> n;
+  if (output == "ncurses")
+  {
+    n = std::make_unique<ncurses>();
+  }
+  else
+  {
+    // Write errors are reported by stream_outputter and worker_sink instead.
+    std::signal(SIGPIPE, SIG_IGN);
   }
 
-  ncurses n;
   boost::asio::io_service io_service(1);
   boost::asio::io_service::work work(io_service);
 
-  outputter out(io_service);
+  boost::asio::signal_set signals(io_service, SIGINT, SIGTERM);
+  signals.async_wait([&io_service](const boost::system::error_code&, int) { io_service.stop(); });
+
+  checkpoint_manager checkpoints(io_service, cursor_path, boost::posix_time::milliseconds(checkpoint_interval), checkpoint_entries);
+  reconnect_scheduler scheduler(io_service, boost::posix_time::milliseconds(reconnect_delay), boost::posix_time::milliseconds(reconnect_max_delay), max_connecting);
+
+  metrics stats;
+  stats.watch_connections([&scheduler]() { return scheduler.report(); });
+  std::unique_ptr<metrics_exporter> exporter;
+  std::unique_ptr<entry_sink> out;
+  std::unique_ptr<dedup_stage> dedup;
+  try
+  {
+    if (!metrics_file.empty() || !metrics_socket.empty())
+      exporter = std::make_unique<metrics_exporter>(io_service, stats, boost::posix_time::milliseconds(metrics_interval), metrics_file, metrics_socket);
+
+    if (output == "worker")
+      out = std::make_unique<worker_sink>(io_service, worker_fd);
+    else if (output == "ncurses")
+      out = std::make_unique<outputter>(io_service, stats, boost::posix_time::microseconds(1000000 / frame_rate), scrollback_size * 1024 * 1024);
+    else
+      out = std::make_unique<stream_outputter>(io_service, output_file, output == "json" ? stream_outputter::format::json : stream_outputter::format::text);
+
+    if (dedup_window > 0)
+      dedup = std::make_unique<dedup_stage>(io_service, boost::posix_time::milliseconds(dedup_window), 4096, *out);
+  } catch (const std::system_error& e)
+  {
+    std::cerr << e.what() << '\n';
+    return 1;
+  } catch (const boost::system::system_error& e)
+  {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+
+  entry_sink& shown = dedup ? static_cast<entry_sink&>(*dedup) : *out;
+  const size_t source_count = remote_hosts.size() + (use_local_journal ? 1 : 0);
+  merge_stage merge(io_service, source_count, boost::posix_time::milliseconds(reorder_window), shown);
+  entry_sink& display_sink = reorder_window > 0 ? static_cast<entry_sink&>(merge) : shown;
+
+  // The readers append to the spool on their own threads, the display
+  // passes the entries on from there at its own pace.
+  std::unique_ptr<entry_spool> spool;
+  if (!spool_directory.empty())
+  {
+    try
+    {
+      const size_t segment_size = 64 * 1024 * 1024;
+      // The entries of the last run get a source id after the current ones.
+      spool = std::make_unique<entry_spool>(io_service, spool_directory, segment_size, spool_size * 1024 * 1024 / segment_size, source_count, display_sink);
+      const auto since = std::chrono::system_clock::now() - std::chrono::minutes(spool_replay);
+      spool->replay(std::chrono::duration_cast<std::chrono::microseconds>(since.time_since_epoch()).count());
+    } catch (const std::system_error& e)
+    {
+      std::cerr << e.what() << '\n';
+      return 1;
+    }
+  }
+  entry_sink& spooled_sink = spool ? static_cast<entry_sink&>(*spool) : display_sink;
+
+  // Without a spool, reader threads pass the entries to the display thread
+  // through a queue.
+  io_service_pool reader_pool(reader_threads);
+  ingest_queue queue(io_service, queue_size, stats, load_shedding, source_count, display_sink);
+  const bool use_queue = reader_threads > 0 && !spool;
+  entry_sink& sink = use_queue ? static_cast<entry_sink&>(queue) : spooled_sink;
+  if (use_queue)
+    stats.watch_queue([&queue]() { return queue.size(); });
+  auto reader_io_service = [&]() -> boost::asio::io_service& {
+    return reader_threads > 0 ? reader_pool.get_io_service() : io_service;
+  };
 
   try
   {
+    std::vector<std::unique_ptr<worker_process>> workers;
+    if (worker_count > 0 && worker_fd < 0)
+    {
+      // Source ids count the local journal first, then the remote hosts in
+      // the order given, as the readers would have added themselves.
+      std::vector<metrics::source*> sources;
+      if (use_local_journal)
+        sources.push_back(&stats.add_source("local"));
+      for (auto&& remote_host : remote_hosts)
+        sources.push_back(&stats.add_source(remote_host));
+
+      const uint32_t first_host = use_local_journal ? 1 : 0;
+      for (size_t shard = 0; shard < worker_count; ++shard)
+      {
+        std::vector<uint32_t> ids;
+        if (use_local_journal && shard == 0)
+          ids.push_back(0);
+        for (size_t i = shard; i < remote_hosts.size(); i += worker_count)
+          ids.push_back(first_host + i);
+        if (ids.empty())
+          continue;
+
+        std::vector<metrics::source*> shard_sources;
+        for (uint32_t id : ids)
+          shard_sources.push_back(sources[id]);
+
+        std::vector<std::string> arguments(argv, argv + argc);
+        arguments.push_back("--worker-shard");
+        arguments.push_back(std::to_string(shard));
+        workers.push_back(std::make_unique<worker_process>(io_service, arguments, ids, shard_sources, spooled_sink));
+      }
+
+      // The workers do the reading.
+      remote_hosts.clear();
+      use_local_journal = false;
+    }
+
     std::unique_ptr<local_journal_reader> local_reader;
     if (use_local_journal)
     {
-      local_reader = std::make_unique<local_journal_reader>(io_service, cursor_path, out);
+      local_reader = std::make_unique<local_journal_reader>(reader_io_service(), checkpoints, stats, journal_directory, filter, projection, local_batch_entries, std::chrono::milliseconds(local_batch_time), sink);
     }
 
     std::vector<std::unique_ptr<remote_journal_reader>> readers;
     readers.reserve(remote_hosts.size());
     for (auto&& remote_host : remote_hosts)
     {
-      readers.push_back(std::make_unique<remote_journal_reader>(io_service, cursor_path, remote_host, out));
+      readers.push_back(std::make_unique<remote_journal_reader>(reader_io_service(), checkpoints, scheduler, stats, filter, projection, catch_up_chunk, remote_host, sink));
     }
 
+    reader_pool.run();
     io_service.run();
+
+    queue.close();
+    reader_pool.stop();
+    // The cursors of the entries still held by the stages are already
+    // stored, so they have to be passed on before the stages go away.
+    sink.flush();
   } catch (const local_journal_reader::call_error& e)
   {
     std::cerr << "Fatal error with local journal: " << e.what() << '\n';
@@ -0,0 +1,126 @@
+#include "merge_stage.h"
+
+#include <boost/bind.hpp>
+
+merge_stage::merge_stage(boost::asio::io_service& io_service, size_t source_count, boost::posix_time::time_duration window, entry_sink& next)
+  : next(next)
+  , window(window)
+  , timer(io_service)
+  , sources(source_count)
+{
+  // Until they had a chance to deliver something all sources are expected to.
+  const auto now = boost::posix_time::microsec_clock::universal_time();
+  for (auto&& s : sources)
+  {
+    s.last_arrival = now;
+    s.live = true;
+  }
+  live_sources = sources.size();
+}
+
+void merge_stage::add_line(const journal_entry& entry)
+{
+  const auto now = boost::posix_time::microsec_clock::universal_time();
+
+  if (entry.source() >= sources.size())
+  {
+    sources.resize(entry.source() + 1);
+  }
+
+  std::unique_ptr<held_entry> held;
+  if (unused.empty())
+  {
+    held = std::make_unique<held_entry>();
+  }
+  else
+  {
+    held = std::move(unused.back());
+    unused.pop_back();
+  }
+
+  held->entry = entry;
+  held->timestamp = entry.realtime_usec();
+  held->sequence = sequence++;
+  held->arrival = now;
+
+  source& s = sources[entry.source()];
+  s.last_arrival = now;
+  if (!s.live)
+  {
+    s.live = true;
+    ++live_sources;
+  }
+
+  if (s.entries.empty())
+  {
+    heads.push(head{held->timestamp, held->sequence, held.get()});
+  }
+  s.entries.push_back(std::move(held));
+
+  release(now);
+}
+
+void merge_stage::release(boost::posix_time::ptime now)
+{
+  while (!heads.empty())
+  {
+    const head top = heads.top();
+
+    // Every live source has an entry held, so no older entry can arrive anymore.
+    const bool complete = heads.size() >= live_sources;
+
+    if (!complete && top.entry->arrival + window > now)
+      break;
+
+    heads.pop();
+
+    source& s = sources[top.entry->entry.source()];
+    std::unique_ptr<held_entry> held = std::move(s.entries.front());
+    s.entries.pop_front();
+
+    if (!s.entries.empty())
+    {
+      const held_entry& following = *s.entries.front();
+      heads.push(head{following.timestamp, following.sequence, s.entries.front().get()});
+    }
+
+    next.add_line(held->entry);
+    unused.push_back(std::move(held));
+  }
+
+  if (!heads.empty() && !timer_scheduled)
+  {
+    timer_scheduled = true;
+    timer.expires_at(heads.top().entry->arrival + window);
+    timer.async_wait(boost::bind(&merge_stage::on_timer, this, _1));
+  }
+}
+
+void merge_stage::flush()
+{
+  // Nothing older can arrive anymore.
+  release(boost::posix_time::ptime(boost::posix_time::pos_infin));
+  next.flush();
+}
+
+void merge_stage::on_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  timer_scheduled = false;
+
+  const auto now = boost::posix_time::microsec_clock::universal_time();
+
+  // Sources which went quiet must not hold back the others.
+  for (auto&& s : sources)
+  {
+    if (s.live && s.entries.empty() && s.last_arrival + window <= now)
+    {
+      s.live = false;
+      --live_sources;
+    }
+  }
+
+  release(now);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "entry_sink.h"
+
+// Passes entries on ordered by __REALTIME_TIMESTAMP across all sources.
+//
+// Each source delivers its entries in order, so only the oldest held entry
+// of every source takes part in a k-way merge. An entry is passed on once
+// every live source has a newer one held, or once it has been held for the
+// reorder window. A source which has not delivered anything for a whole
+// window is no longer considered live and therefore never stalls the others.
+class merge_stage : public entry_sink
+{
+  struct held_entry
+  {
+    journal_entry entry;
+    uint64_t timestamp;
+    uint64_t sequence;
+    boost::posix_time::ptime arrival;
+  };
+
+  struct source
+  {
+    std::deque<std::unique_ptr<held_entry>> entries;
+    boost::posix_time::ptime last_arrival;
+    bool live = false;
+  };
+
+  struct head
+  {
+    uint64_t timestamp;
+    uint64_t sequence;
+    held_entry* entry;
+
+    bool operator<(const head& other) const
+    {
+      // Reversed for a min-heap.
+      if (timestamp != other.timestamp)
+        return timestamp > other.timestamp;
+      return sequence > other.sequence;
+    }
+  };
+
+  entry_sink& next;
+  const boost::posix_time::time_duration window;
+  boost::asio::deadline_timer timer;
+  bool timer_scheduled = false;
+  std::deque<source> sources;
+  std::priority_queue<head> heads;
+  std::vector<std::unique_ptr<held_entry>> unused;
+  uint64_t sequence = 0;
+  size_t live_sources = 0;
+
+  void release(boost::posix_time::ptime now);
+  void on_timer(const boost::system::error_code& ec);
+
+public:
+  merge_stage(boost::asio::io_service& io_service, size_t source_count, boost::posix_time::time_duration window, entry_sink& next);
+
+  void add_line(const journal_entry& entry) override;
+  void flush() override;
+};
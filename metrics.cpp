@@ -0,0 +1,172 @@
+#include "metrics.h"
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace
+{
+unsigned bucket_index(uint64_t value)
+{
+  unsigned index = 0;
+  while (value != 0)
+  {
+    ++index;
+    value >>= 1;
+  }
+  return index;
+}
+
+// Sources without a batch for this long are left out of the lag.
+const uint64_t recent_batch_usec = 10 * 1000 * 1000;
+
+uint64_t now_usec()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+}
+
+void metrics::histogram::record(uint64_t value)
+{
+  buckets[std::min<size_t>(bucket_index(value), buckets.size() - 1)].add(1);
+}
+
+uint64_t metrics::histogram::quantile(double q) const
+{
+  uint64_t total = 0;
+  for (auto&& bucket : buckets)
+    total += bucket.get();
+  if (total == 0)
+    return 0;
+
+  const uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(q * total), 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i)
+  {
+    seen += buckets[i].get();
+    if (seen >= rank)
+      return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+  }
+  return (uint64_t(1) << (buckets.size() - 1)) - 1;
+}
+
+void metrics::source::received(uint64_t timestamp)
+{
+  if (timestamp == 0)
+    return;
+
+  last_timestamp.set(timestamp);
+  const uint64_t now = now_usec();
+  const uint64_t lag_ms = now > timestamp ? (now - timestamp) / 1000 : 0;
+  lag.record(lag_ms);
+  last_lag.set(lag_ms);
+  last_batch.set(now);
+}
+
+metrics::source& metrics::add_source(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  sources.push_back(std::make_unique<source>(name));
+  return *sources.back();
+}
+
+metrics::source* metrics::find_source(size_t index)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return index < sources.size() ? sources[index].get() : nullptr;
+}
+
+void metrics::watch_queue(std::function<size_t()> depth)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  queue_depth = std::move(depth);
+}
+
+void metrics::watch_connections(std::function<std::string()> report)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  connections = std::move(report);
+}
+
+std::string metrics::status_line()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  rate_sample sample;
+  sample.time = std::chrono::steady_clock::now();
+  uint64_t reconnects = 0;
+  uint64_t shed = 0;
+  uint64_t lag_ms = 0;
+  const uint64_t now = now_usec();
+  for (auto&& s : sources)
+  {
+    sample.entries += s->entries.get();
+    sample.bytes += s->bytes.get();
+    reconnects += s->reconnects.get();
+    for (auto&& c : s->shed)
+      shed += c.get();
+    if (s->last_batch.get() + recent_batch_usec >= now)
+      lag_ms = std::max(lag_ms, s->last_lag.get());
+  }
+
+  if (sample.time - last_sample.time >= std::chrono::seconds(1))
+  {
+    previous_sample = last_sample;
+    last_sample = sample;
+  }
+
+  const std::chrono::duration<double> elapsed = last_sample.time - previous_sample.time;
+  const bool have_rate = previous_sample.time != std::chrono::steady_clock::time_point() && elapsed.count() > 0;
+  const double entry_rate = have_rate ? (last_sample.entries - previous_sample.entries) / elapsed.count() : 0;
+  const double byte_rate = have_rate ? (last_sample.bytes - previous_sample.bytes) / elapsed.count() : 0;
+
+  return (boost::format("%1$.0f entries/s  %2$.1f kB/s  lag %3$.1fs  queue %4%  skipped %5%  shed %6%  reconnects %7%  frame p99 %8%us %9%B")
+    % entry_rate
+    % (byte_rate / 1e3)
+    % (lag_ms / 1e3)
+    % (queue_depth ? queue_depth() : 0)
+    % skipped_lines.get()
+    % shed
+    % reconnects
+    % render_time.quantile(0.99)
+    % frame_bytes.quantile(0.99)).str();
+}
+
+std::string metrics::report() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::string out;
+  out += (boost::format("time %1%\n") % boost::posix_time::to_iso_extended_string(boost::posix_time::microsec_clock::universal_time())).str();
+  out += (boost::format("queue_depth %1%\n") % (queue_depth ? queue_depth() : 0)).str();
+  out += (boost::format("skipped_lines %1%\n") % skipped_lines.get()).str();
+  out += (boost::format("render_time_us p50 %1% p99 %2%\n") % render_time.quantile(0.5) % render_time.quantile(0.99)).str();
+  out += (boost::format("frame_bytes p50 %1% p99 %2%\n") % frame_bytes.quantile(0.5) % frame_bytes.quantile(0.99)).str();
+  out += (boost::format("terminal_bytes %1%\n") % terminal_bytes.get()).str();
+
+  for (auto&& s : sources)
+  {
+    out += (boost::format("source %1% entries %2% bytes %3% reconnects %4% last_timestamp %5% parse_us p50 %6% p99 %7% lag_ms p50 %8% p99 %9%\n")
+      % s->name
+      % s->entries.get()
+      % s->bytes.get()
+      % s->reconnects.get()
+      % s->last_timestamp.get()
+      % s->parse_latency.quantile(0.5)
+      % s->parse_latency.quantile(0.99)
+      % s->lag.quantile(0.5)
+      % s->lag.quantile(0.99)).str();
+
+    for (int priority = 0; priority < static_cast<int>(s->shed.size()); ++priority)
+    {
+      if (s->shed[priority].get() != 0)
+        out += (boost::format("source %1% shed priority %2% entries %3%\n") % s->name % priority % s->shed[priority].get()).str();
+    }
+  }
+
+  if (connections)
+    out += connections();
+
+  return out;
+}
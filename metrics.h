@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Counters and histograms describing the work done by the pipeline.
+//
+// Every value has a single writer: each source is updated only by the
+// thread of its reader, the display values only by the display thread.
+// Updates are therefore plain relaxed loads and stores without any locked
+// instruction, while other threads can read consistent enough values for
+// reporting at any time.
+class metrics
+{
+public:
+  class counter
+  {
+    std::atomic<uint64_t> value{0};
+
+  public:
+    void add(uint64_t n)
+    {
+      value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t n)
+    {
+      value.store(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const
+    {
+      return value.load(std::memory_order_relaxed);
+    }
+  };
+
+  // Counts values in power of two buckets.
+  class histogram
+  {
+    std::array<counter, 40> buckets;
+
+  public:
+    void record(uint64_t value);
+
+    // Returns the upper bound of the bucket containing the given quantile,
+    // 0 if nothing was recorded.
+    uint64_t quantile(double q) const;
+  };
+
+  struct source
+  {
+    const std::string name;
+    counter entries;
+    // Bytes received, before decompression.
+    counter bytes;
+    counter reconnects;
+    // __REALTIME_TIMESTAMP of the latest entry.
+    counter last_timestamp;
+    // Microseconds spent parsing each batch of received data.
+    histogram parse_latency;
+    // Milliseconds between the creation of the last entry of each batch and
+    // its arrival.
+    histogram lag;
+    // The same for the latest batch, and when it arrived in microseconds
+    // since the epoch.
+    counter last_lag;
+    counter last_batch;
+    // Entries dropped by load shedding, by priority.
+    std::array<counter, 8> shed;
+
+    explicit source(const std::string& name)
+      : name(name)
+    {
+    }
+
+    // Records the __REALTIME_TIMESTAMP of the last entry of a batch.
+    void received(uint64_t timestamp);
+  };
+
+  // Lines the display could not show.
+  counter skipped_lines;
+  // Microseconds spent drawing each frame.
+  histogram render_time;
+  // Bytes sent to the terminal for each frame.
+  histogram frame_bytes;
+  counter terminal_bytes;
+
+private:
+  struct rate_sample
+  {
+    std::chrono::steady_clock::time_point time;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+  };
+
+  std::deque<std::unique_ptr<source>> sources;
+  std::function<size_t()> queue_depth;
+  std::function<std::string()> connections;
+  mutable std::mutex mutex;
+  rate_sample last_sample;
+  rate_sample previous_sample;
+
+public:
+  // The returned source stays valid as long as the metrics.
+  source& add_source(const std::string& name);
+
+  // Returns the source added at the given position, nullptr if there is
+  // none. Readers add themselves here and to the checkpoint_manager at the
+  // same time, so the position is the id of the source in its entries.
+  source* find_source(size_t index);
+
+  // Reports the number of entries waiting for the display.
+  void watch_queue(std::function<size_t()> depth);
+
+  // Adds the connection state of the hosts to report(), as text with one
+  // line per host.
+  void watch_connections(std::function<std::string()> report);
+
+  // One line summary for the screen. Rates are averaged over at least one
+  // second. The lag is the largest of the latest batches of the sources
+  // which received one recently, so idle hosts do not count. Only to be
+  // called from a single thread.
+  std::string status_line();
+
+  // Text report with one line per source, for the metrics file and socket.
+  std::string report() const;
+};
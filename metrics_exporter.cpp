@@ -0,0 +1,106 @@
+#include "metrics_exporter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+#include <boost/bind.hpp>
+
+#include <systemd/sd-journal.h>
+
+metrics_exporter::metrics_exporter(boost::asio::io_service& io_service, metrics& stats, boost::posix_time::time_duration interval, const std::string& file_path, const std::string& socket_path)
+  : io_service(io_service)
+  , stats(stats)
+  , file_path(file_path)
+  , socket_path(socket_path)
+  , interval(interval)
+  , timer(io_service)
+{
+  if (!socket_path.empty())
+  {
+    // A socket left behind by an earlier run would make bind() fail.
+    unlink(socket_path.c_str());
+
+    try
+    {
+      acceptor = std::make_unique<boost::asio::local::stream_protocol::acceptor>(io_service, boost::asio::local::stream_protocol::endpoint(socket_path));
+    } catch (const boost::system::system_error& e)
+    {
+      throw std::system_error(e.code().value(), std::generic_category(), "Error creating metrics socket '" + socket_path + "'");
+    }
+    accept();
+  }
+
+  if (!file_path.empty())
+  {
+    timer.expires_from_now(interval);
+    timer.async_wait(boost::bind(&metrics_exporter::on_timer, this, _1));
+  }
+}
+
+metrics_exporter::~metrics_exporter()
+{
+  if (acceptor)
+  {
+    acceptor->close();
+    unlink(socket_path.c_str());
+  }
+}
+
+void metrics_exporter::on_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  write_file();
+
+  timer.expires_at(timer.expires_at() + interval);
+  timer.async_wait(boost::bind(&metrics_exporter::on_timer, this, _1));
+}
+
+void metrics_exporter::write_file()
+{
+  const std::string report = stats.report();
+  const std::string temp_path = file_path + ".tmp";
+
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    sd_journal_print(LOG_WARNING, "Error opening metrics file '%s': %s", temp_path.c_str(), strerror(errno));
+    return;
+  }
+
+  const bool ok = ::write(fd, report.data(), report.size()) == static_cast<ssize_t>(report.size());
+  if (!ok)
+  {
+    sd_journal_print(LOG_WARNING, "Error writing metrics file '%s': %s", temp_path.c_str(), strerror(errno));
+  }
+
+  close(fd);
+
+  if (ok && std::rename(temp_path.c_str(), file_path.c_str()) != 0)
+  {
+    sd_journal_print(LOG_WARNING, "Error replacing metrics file '%s': %s", file_path.c_str(), strerror(errno));
+  }
+}
+
+void metrics_exporter::accept()
+{
+  auto socket = std::make_shared<boost::asio::local::stream_protocol::socket>(io_service);
+  acceptor->async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted)
+      return;
+
+    if (!ec)
+    {
+      auto report = std::make_shared<std::string>(stats.report());
+      boost::asio::async_write(*socket, boost::asio::buffer(*report), [socket, report](const boost::system::error_code&, size_t) {});
+    }
+
+    accept();
+  });
+}
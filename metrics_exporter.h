@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "metrics.h"
+
+// Makes the metrics report available outside of the screen.
+//
+// The report is written to a file every interval, replacing it atomically.
+// Clients connecting to the Unix socket receive the current report and the
+// connection is closed. Either path may be empty to disable it.
+class metrics_exporter
+{
+  boost::asio::io_service& io_service;
+  metrics& stats;
+  const std::string file_path;
+  const std::string socket_path;
+  const boost::posix_time::time_duration interval;
+  boost::asio::deadline_timer timer;
+  std::unique_ptr<boost::asio::local::stream_protocol::acceptor> acceptor;
+
+  void on_timer(const boost::system::error_code& ec);
+  void write_file();
+  void accept();
+
+public:
+  // Throws std::system_error if the socket cannot be created.
+  metrics_exporter(boost::asio::io_service& io_service, metrics& stats, boost::posix_time::time_duration interval, const std::string& file_path, const std::string& socket_path);
+  ~metrics_exporter();
+};
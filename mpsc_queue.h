@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for multiple producers and a single consumer.
+//
+// Based on Dmitry Vyukov's bounded MPMC queue. Values stay in their cell and
+// are assigned to instead of being constructed, so element types which keep
+// their capacity on assignment (like journal_entry) do not allocate once the
+// queue has warmed up.
+template<typename T>
+class mpsc_queue
+{
+  struct cell
+  {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  const size_t mask;
+  std::unique_ptr<cell[]> cells;
+  alignas(64) std::atomic<size_t> enqueue_pos;
+  alignas(64) size_t dequeue_pos;
+
+  static size_t round_up(size_t capacity)
+  {
+    size_t result = 2;
+    while (result < capacity)
+      result *= 2;
+    return result;
+  }
+
+public:
+  explicit mpsc_queue(size_t capacity)
+    : mask(round_up(capacity) - 1)
+    , cells(new cell[mask + 1])
+    , enqueue_pos(0)
+    , dequeue_pos(0)
+  {
+    for (size_t i = 0; i <= mask; ++i)
+    {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const
+  {
+    return mask + 1;
+  }
+
+  // Number of queued values. Only exact if no push is in progress.
+  size_t size() const
+  {
+    return enqueue_pos.load(std::memory_order_relaxed) - dequeue_pos;
+  }
+
+  // May be called from any thread. Returns false if the queue is full.
+  template<typename U>
+  bool try_push(U&& value)
+  {
+    cell* c;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      c = &cells[pos & mask];
+      const size_t sequence = c->sequence.load(std::memory_order_acquire);
+      const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+      if (difference == 0)
+      {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (difference < 0)
+      {
+        return false;
+      }
+      else
+      {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    c->value = std::forward<U>(value);
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Must only be called from the consumer thread. Calls f with the oldest
+  // value, which is only valid during the call. Returns false if the queue is
+  // empty.
+  template<typename F>
+  bool try_pop(F&& f)
+  {
+    cell& c = cells[dequeue_pos & mask];
+    const size_t sequence = c.sequence.load(std::memory_order_acquire);
+
+    if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeue_pos + 1) < 0)
+      return false;
+
+    f(c.value);
+
+    c.sequence.store(dequeue_pos + mask + 1, std::memory_order_release);
+    ++dequeue_pos;
+    return true;
+  }
+};
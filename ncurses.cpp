@@ -7,14 +7,23 @@ ncurses::ncurses()
 {
   setlocale(LC_ALL, "");
   initscr();
+  // Keys are read by scrollback_view.
+  cbreak();
+  noecho();
   start_color();
+  // Lines are drawn in the colors of the terminal, so only colored lines
+  // need color sequences and no line has to switch back to white on black.
+  use_default_colors();
   scrollok(stdscr, TRUE);
+  // The cursor is not placed anywhere meaningful on the screen, so it need
+  // not be moved back after each update.
+  leaveok(stdscr, TRUE);
 
   if (has_colors())
   {
-    init_pair(1, COLOR_RED, COLOR_BLACK);
-    init_pair(2, COLOR_YELLOW, COLOR_BLACK);
-    init_pair(3, COLOR_BLUE, COLOR_BLACK);
+    init_pair(1, COLOR_RED, -1);
+    init_pair(2, COLOR_YELLOW, -1);
+    init_pair(3, COLOR_BLUE, -1);
   }
 
   wprintw(stdscr, "Starting ...");
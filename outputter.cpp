@@ -1,10 +1,15 @@
 #include "outputter.h"
 
+#include <fcntl.h>
 #include <ncurses.h>
+#include <string.h>
+#include <unistd.h>
 
-#include <boost/algorithm/string/replace.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/date_time/c_local_time_adjustor.hpp>
+#include <chrono>
+
+#include <boost/bind.hpp>
+
+#include "line_format.h"
 
 namespace
 {
@@ -19,138 +24,282 @@ enum class Level
   info,
   debug
 };
+
+int line_color(Level level)
+{
+  if (!has_colors())
+    return 0;
+
+  switch (level)
+  {
+    case Level::emerg:
+    case Level::crit:
+    case Level::err:
+    case Level::alert:
+      return 1;
+    case Level::warning:
+      return 2;
+    case Level::info:
+    case Level::notice:
+      return 0;
+    case Level::debug:
+      return 3;
+  }
+
+  return 0;
 }
 
-outputter::outputter(boost::asio::io_service& io_service)
-  : io_service(io_service)
+// Bytes written by the calling thread so far, 0 if the kernel does not
+// account them. ncurses writes to the terminal file descriptor itself, so
+// its output can only be counted here.
+uint64_t thread_bytes_written(int write_accounting)
 {
-  getmaxyx(stdscr,row,col);
+  char buffer[512];
+  const ssize_t size = write_accounting >= 0 ? pread(write_accounting, buffer, sizeof(buffer) - 1, 0) : -1;
+  if (size <= 0)
+    return 0;
+  buffer[size] = '\0';
+
+  const char* wchar = strstr(buffer, "wchar: ");
+  return wchar != nullptr ? strtoull(wchar + 7, nullptr, 10) : 0;
 }
 
-void outputter::add_line(const std::map<std::string, std::string>& values)
+// Compares like dedup_stage identifies repeats, with runs of digits as equal.
+bool same_message(boost::string_view a, boost::string_view b)
 {
-  static std::locale locale(std::cout.getloc(), new boost::posix_time::time_facet("%H:%M:%S"));
+  const auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
 
-  boost::posix_time::ptime time;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.size() && j < b.size())
   {
-    auto it = values.find("__REALTIME_TIMESTAMP");
-    if (it != values.end())
+    if (is_digit(a[i]) && is_digit(b[j]))
+    {
+      while (i < a.size() && is_digit(a[i]))
+        ++i;
+      while (j < b.size() && is_digit(b[j]))
+        ++j;
+    }
+    else if (a[i++] != b[j++])
     {
-      long timestamp = boost::lexical_cast<long>(it->second);
-      time = boost::posix_time::ptime(boost::gregorian::date(1970,1,1) , boost::posix_time::microseconds(timestamp));
-      using local_adj = boost::date_time::c_local_adjustor<boost::posix_time::ptime>;
-      time = local_adj::utc_to_local(time);
+      return false;
     }
   }
+  return i == a.size() && j == b.size();
+}
+}
+
+outputter::outputter(boost::asio::io_service& io_service, metrics& stats, boost::posix_time::time_duration frame_interval, size_t scrollback_size)
+  : io_service(io_service)
+  , stats(stats)
+  , frame_interval(frame_interval)
+  , frame_timer(io_service)
+  , last_frame(boost::posix_time::min_date_time)
+  , status_timer(io_service)
+  , error_timeouts(io_service, boost::posix_time::milliseconds(250), error_visibility_duration, std::bind(&outputter::errorTimeout, this))
+  // The screen is drawn on the thread running io_service, which creates
+  // the outputter.
+  , write_accounting(open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC))
+{
+  getmaxyx(stdscr,row,col);
+  // The bottom row is kept for the status line.
+  row = std::max(row - 1, 1);
+  wsetscrreg(stdscr, 0, row-1);
+  // One screen's worth of lines, leaving room for the skipped lines notice.
+  pending.resize(std::max(row - 2, 1));
 
-  Level level = Level::notice;
+  if (scrollback_size > 0)
   {
-    auto it = values.find("PRIORITY");
-    if (it != values.end())
+    scrollback = std::make_unique<scrollback_store>(scrollback_size);
+    view = std::make_unique<scrollback_view>(io_service, *scrollback);
+  }
+
+  status_timer.expires_from_now(boost::posix_time::seconds(1));
+  status_timer.async_wait(boost::bind(&outputter::on_status_timer, this, _1));
+}
+
+outputter::~outputter()
+{
+  if (write_accounting >= 0)
+    close(write_accounting);
+}
+
+void outputter::add_line(const journal_entry& entry)
+{
+  const int priority = entry_priority(entry);
+  formatted.clear();
+  format_line(entry, formatted);
+  const size_t key_end = std::min(formatted.size(), static_cast<size_t>(col - 1));
+  append_repeats(entry, formatted);
+  if (scrollback)
+    scrollback->append(entry.realtime_usec(), priority, entry.get(well_known_field::hostname), formatted);
+  if (formatted.size() > static_cast<size_t>(col - 1))
+    formatted.resize(col - 1);
+  const size_t key_begin = std::min(formatted.find(' ') + 1, key_end);
+  const boost::string_view key = boost::string_view(formatted).substr(key_begin, key_end - key_begin);
+
+  // A newer count of the line still waiting replaces it.
+  if (entry.repeats() > 1 && pending_count > 0)
+  {
+    pending_line& last = pending[(pending_begin + pending_count - 1) % pending.size()];
+    if (same_message(last.key(), key))
     {
-      if (it->second == "0")
-        level = Level::emerg;
-      else if (it->second == "1")
-        level = Level::alert;
-      else if (it->second == "2")
-        level = Level::crit;
-      else if (it->second == "3")
-        level = Level::err;
-      else if (it->second == "4")
-        level = Level::warning;
-      else if (it->second == "5")
-        level = Level::notice;
-      else if (it->second == "6")
-        level = Level::info;
-      else if (it->second == "7")
-        level = Level::debug;
+      last.text = formatted;
+      last.key_begin = key_begin;
+      last.key_end = key_end;
+      return;
     }
   }
 
-  std::string machine;
+  pending_line& line = push_pending(priority);
+  line.text = formatted;
+  line.key_begin = key_begin;
+  line.key_end = key_end;
+  line.repeat = entry.repeats() > 1;
+
+  schedule_frame();
+}
+
+outputter::pending_line& outputter::push_pending(int priority)
+{
+  if (pending_count == pending.size())
   {
-    auto it = values.find("_HOSTNAME");
-    if (it != values.end())
-      machine = it->second;
-    else
-      machine = "<none>";
+    // More lines arrived than fit on the screen since the last frame. Drop
+    // the oldest one, but keep errors as long as possible.
+    size_t drop = 0;
+    while (drop < pending_count && pending[(pending_begin + drop) % pending.size()].priority <= static_cast<int>(Level::err))
+      ++drop;
+    if (drop == pending_count)
+      drop = 0;
+
+    for (size_t i = drop; i > 0; --i)
+    {
+      std::swap(pending[(pending_begin + i) % pending.size()], pending[(pending_begin + i - 1) % pending.size()]);
+    }
+
+    pending_begin = (pending_begin + 1) % pending.size();
+    --pending_count;
+    ++skipped_lines;
+    stats.skipped_lines.add(1);
   }
 
-  std::string process;
+  pending_line& line = pending[(pending_begin + pending_count) % pending.size()];
+  ++pending_count;
+  line.priority = priority;
+  return line;
+}
+
+void outputter::schedule_frame()
+{
+  if (frame_scheduled)
+    return;
+
+  frame_scheduled = true;
+  frame_timer.expires_at(std::max(last_frame + frame_interval, boost::posix_time::microsec_clock::universal_time()));
+  frame_timer.async_wait(std::bind(&outputter::render_frame, this));
+}
+
+void outputter::render_frame()
+{
+  frame_scheduled = false;
+  last_frame = boost::posix_time::microsec_clock::universal_time();
+  const auto start = std::chrono::steady_clock::now();
+
+  if (skipped_lines > 0)
   {
-    auto it = values.find("_COMM");
-    if (it != values.end())
-      process = it->second;
-    else
-      process = "kernel";
+    const std::string text = "-- " + std::to_string(skipped_lines) + " lines skipped --";
+    if (draw_line(text, static_cast<int>(Level::notice)))
+      skipped_lines = 0;
+    last_key.clear();
   }
 
-  std::string message;
+  for (; pending_count > 0; --pending_count)
   {
-    auto it = values.find("MESSAGE");
-    if (it != values.end())
-      message = it->second;
+    const pending_line& line = pending[pending_begin];
+    pending_begin = (pending_begin + 1) % pending.size();
+
+    if (line.repeat && !last_key.empty() && same_message(line.key(), last_key))
+    {
+      redraw_last_line(line.text, line.priority);
+    }
+    else if (draw_line(line.text, line.priority))
+    {
+      last_key.assign(line.key().data(), line.key().size());
+    }
     else
-      message = "<none>";
+    {
+      ++skipped_lines;
+      stats.skipped_lines.add(1);
+      last_key.clear();
+    }
   }
 
-  //TODO: Improve escpaing
-  boost::replace_all(message, "\n", "\\n");
+  // While the scrollback is shown the screen is only updated in memory.
+  if (view && view->active())
+    view->update();
+  else
+    update_terminal();
+
+  stats.render_time.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void outputter::draw_status()
+{
+  const std::string text = stats.status_line();
+
+  attron(A_REVERSE);
+  mvwaddnstr(stdscr, row, 0, text.c_str(), std::min<int>(text.size(), col));
+  for (int x = std::min<int>(text.size(), col); x < col - 1; ++x)
+    waddch(stdscr, ' ');
+  attroff(A_REVERSE);
+}
+
+void outputter::update_terminal()
+{
+  const uint64_t before = thread_bytes_written(write_accounting);
+  refresh();
+  const uint64_t bytes = thread_bytes_written(write_accounting) - before;
+
+  stats.frame_bytes.record(bytes);
+  stats.terminal_bytes.add(bytes);
+}
+
+void outputter::on_status_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  draw_status();
+  if (!view || !view->active())
+    update_terminal();
+
+  status_timer.expires_at(status_timer.expires_at() + boost::posix_time::seconds(1));
+  status_timer.async_wait(boost::bind(&outputter::on_status_timer, this, _1));
+}
+
+bool outputter::draw_line(const std::string& text, int priority)
+{
+  const Level level = static_cast<Level>(priority);
 
   if (errors_scroll_out > 0)
   {
     assert(all_above_errors_line > 0);
-    wsetscrreg(stdscr, 0, row-1);
+    set_scroll_top(0);
   }
 
   if (errors_scroll_out == 0 && all_above_errors_line == row-1)
   {
-    return;
+    return false;
   }
 
-  int color = 0;
-
-  if (has_colors())
-  {
-    switch (level)
-    {
-      case Level::emerg:
-      case Level::crit:
-      case Level::err:
-      case Level::alert:
-        color = 1;
-        break;
-      case Level::warning:
-        color = 2;
-        break;
-      case Level::info:
-      case Level::notice:
-        color = 0;
-        break;
-      case Level::debug:
-        color = 3;
-        break;
-    }
-
-  }
+  const int color = line_color(level);
 
   if (color != 0)
   {
     attron(COLOR_PAIR(color));
   }
 
-  std::stringstream time_stream;
-  time_stream.imbue(locale);
-  time_stream << time;
-  const std::string time_string = time_stream.str();
-  mvwaddnstr(stdscr, row-1,0, time_string.c_str(), time_string.size());
-  waddch(stdscr, ' ');
-  waddnstr(stdscr, machine.c_str(), machine.size());
-  waddch(stdscr, ' ');
-  waddnstr(stdscr, process.c_str(), process.size());
-  waddstr(stdscr, ": ");
-  const size_t message_length = std::min(message.size(), col - time_string.size() - machine.size() - process.size() - 4 - 1);
-  waddnstr(stdscr, message.c_str(), message_length);
+  mvwaddnstr(stdscr, row-1,0, text.c_str(), text.size());
   waddch(stdscr, '\n');
 
   if (color != 0)
@@ -158,10 +307,9 @@ void outputter::add_line(const std::map<std::string, std::string>& values)
     attroff(COLOR_PAIR(color));
   }
 
-  std::for_each(in_stream_error_lines.begin(), in_stream_error_lines.end(), [](int& value) { --value; });
-  assert(std::all_of(in_stream_error_lines.begin(), in_stream_error_lines.end(), [all_above_errors_line = this->all_above_errors_line](const int& value) {
-        return value >= all_above_errors_line;
-  }));
+  // Moves all error lines in the stream up by one row.
+  ++lines_drawn;
+  assert(in_stream_error_lines.empty() || error_row(in_stream_error_lines.front()) >= all_above_errors_line);
 
 
   switch (level)
@@ -171,12 +319,8 @@ void outputter::add_line(const std::map<std::string, std::string>& values)
     case Level::err:
       {
         assert(row-2 >= all_above_errors_line);
-        assert(row-2 <= this->row);
-        in_stream_error_lines.push_back(row-2);
-        auto timer = std::make_unique<boost::asio::deadline_timer>(io_service);
-        timer->expires_from_now(error_visibility_duration);
-        timer->async_wait(std::bind(&outputter::errorTimeout, this));
-        timers.push_back(std::move(timer));
+        in_stream_error_lines.push_back(lines_drawn);
+        error_timeouts.schedule(error_visibility_duration);
       }
       break;
     default:
@@ -187,32 +331,52 @@ void outputter::add_line(const std::map<std::string, std::string>& values)
   {
     assert(all_above_errors_line > 0);
     --all_above_errors_line;
-    assert(std::all_of(in_stream_error_lines.begin(), in_stream_error_lines.end(), [all_above_errors_line = this->all_above_errors_line](const int& value) {
-          return value <= all_above_errors_line;
-    }));
+    assert(in_stream_error_lines.empty() || error_row(in_stream_error_lines.back()) <= all_above_errors_line);
     assert(errors_scroll_out > 0);
     --errors_scroll_out;
   }
 
-  while (!in_stream_error_lines.empty() && in_stream_error_lines.front() == all_above_errors_line)
+  while (!in_stream_error_lines.empty() && error_row(in_stream_error_lines.front()) == all_above_errors_line)
   {
     ++all_above_errors_line;
-    in_stream_error_lines.erase(in_stream_error_lines.begin());
+    in_stream_error_lines.pop_front();
+  }
+
+  assert(in_stream_error_lines.empty() || error_row(in_stream_error_lines.front()) >= all_above_errors_line);
 
-    assert(std::all_of(in_stream_error_lines.begin(), in_stream_error_lines.end(), [all_above_errors_line = this->all_above_errors_line](const int& value) {
-          return value >= all_above_errors_line;
-    }));
+  if (errors_scroll_out == 0)
+  {
+    set_scroll_top(all_above_errors_line);
   }
 
-  assert(std::all_of(in_stream_error_lines.begin(), in_stream_error_lines.end(), [all_above_errors_line = this->all_above_errors_line](const int& value) {
-        return value >= all_above_errors_line;
-  }));
+  return true;
+}
 
-  refresh();
+void outputter::set_scroll_top(int top)
+{
+  if (top == scroll_top)
+    return;
 
-  if (errors_scroll_out == 0)
+  wsetscrreg(stdscr, top, row-1);
+  scroll_top = top;
+}
+
+void outputter::redraw_last_line(const std::string& text, int priority)
+{
+  const int color = line_color(static_cast<Level>(priority));
+
+  if (color != 0)
   {
-    wsetscrreg(stdscr, all_above_errors_line, row-1);
+    attron(COLOR_PAIR(color));
+  }
+
+  mvwaddnstr(stdscr, row-2, 0, text.c_str(), text.size());
+  wclrtoeol(stdscr);
+  wmove(stdscr, row-1, 0);
+
+  if (color != 0)
+  {
+    attroff(COLOR_PAIR(color));
   }
 }
 
@@ -222,10 +386,8 @@ void outputter::errorTimeout()
   {
     ++errors_scroll_out;
   }
-  else
+  else if (!in_stream_error_lines.empty())
   {
-    in_stream_error_lines.erase(in_stream_error_lines.begin());
+    in_stream_error_lines.pop_front();
   }
-
-  timers.erase(timers.begin());
 }
@@ -1,21 +1,97 @@
 #pragma once
 
+#include <deque>
+
 #include <boost/asio.hpp>
 
-class outputter
+#include "entry_sink.h"
+#include "metrics.h"
+#include "scrollback_store.h"
+#include "scrollback_view.h"
+#include "timer_wheel.h"
+
+// Shows the entries on the ncurses screen.
+//
+// Entries are collected and drawn at most once per frame_interval. If more
+// entries arrive than fit on the screen in between, the oldest are skipped.
+// All lines are also kept in a scrollback_store the user can page through.
+// The bottom row shows a status line with the pipeline metrics, updated
+// once per second, as rewriting it every frame would cost more terminal
+// output than the lines themselves at moderate rates. Collapsed repeats of
+// the last line replace it instead of taking another row.
+class outputter : public entry_sink
 {
+  struct pending_line
+  {
+    std::string text;
+    int priority;
+    // The part of text without time and repeat count, which is the same
+    // for all repeats of a message.
+    size_t key_begin;
+    size_t key_end;
+    // Drawn over the last line if that is the same message.
+    bool repeat;
+
+    boost::string_view key() const
+    {
+      return boost::string_view(text).substr(key_begin, key_end - key_begin);
+    }
+  };
+
   boost::asio::io_service& io_service;
+  metrics& stats;
+  const boost::posix_time::time_duration frame_interval;
+  boost::asio::deadline_timer frame_timer;
+  bool frame_scheduled = false;
+  boost::posix_time::ptime last_frame;
+  boost::asio::deadline_timer status_timer;
+  std::vector<pending_line> pending;
+  size_t pending_begin = 0;
+  size_t pending_count = 0;
+  size_t skipped_lines = 0;
+  std::string formatted;
+  // Key of the last line drawn, empty if it was no entry.
+  std::string last_key;
   int row,col;
   int all_above_errors_line = 0;
-  std::vector<int> in_stream_error_lines;
-  std::vector<std::unique_ptr<boost::asio::deadline_timer>> timers;
+  // Top row of the scrolling region set on stdscr.
+  int scroll_top = 0;
+  // Number of lines drawn so far. Error lines which are not pinned yet are
+  // kept as the value it had when they were drawn, so scrolling does not
+  // need to update them.
+  uint64_t lines_drawn = 0;
+  std::deque<uint64_t> in_stream_error_lines;
   int errors_scroll_out = 0;
   const boost::posix_time::time_duration error_visibility_duration = boost::posix_time::seconds(8);
+  timer_wheel error_timeouts;
+  std::unique_ptr<scrollback_store> scrollback;
+  std::unique_ptr<scrollback_view> view;
+  // /proc/thread-self/io of the thread drawing the screen, -1 if missing.
+  int write_accounting;
+
+  pending_line& push_pending(int priority);
+  void schedule_frame();
+  void render_frame();
+  void draw_status();
+  void update_terminal();
+  void set_scroll_top(int top);
+  void on_status_timer(const boost::system::error_code& ec);
+  bool draw_line(const std::string& text, int priority);
+  void redraw_last_line(const std::string& text, int priority);
+
+  // Screen row of the line drawn as the given one.
+  int error_row(uint64_t line) const
+  {
+    return row - 2 - static_cast<int>(lines_drawn - line);
+  }
 
 public:
-  outputter(boost::asio::io_service& io_service);
+  // scrollback_size is the memory used for the scrollback in bytes, 0
+  // disables it.
+  outputter(boost::asio::io_service& io_service, metrics& stats, boost::posix_time::time_duration frame_interval, size_t scrollback_size);
+  ~outputter();
 
-  void add_line(const std::map<std::string, std::string>& values);
+  void add_line(const journal_entry& entry) override;
 
   void errorTimeout();
 };
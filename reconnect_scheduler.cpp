@@ -0,0 +1,169 @@
+#include "reconnect_scheduler.h"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/format.hpp>
+
+reconnect_scheduler::reconnect_scheduler(boost::asio::io_service& io_service, boost::posix_time::time_duration initial_delay, boost::posix_time::time_duration max_delay, size_t max_pending)
+  : initial_delay(initial_delay)
+  , max_delay(std::max(max_delay, initial_delay))
+  , max_pending(std::max<size_t>(max_pending, 1))
+  , timer(io_service)
+  , random(std::random_device()())
+{
+}
+
+reconnect_scheduler::host_id reconnect_scheduler::add_host(const std::string& name, boost::asio::io_service& io_service, std::function<void()> connect)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  hosts.push_back(std::make_unique<host>(name, io_service, std::move(connect)));
+  return hosts.size() - 1;
+}
+
+void reconnect_scheduler::request(host_id id)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  host& h = *hosts[id];
+  if (h.state == host_state::connecting)
+    --pending;
+  h.state = host_state::queued;
+
+  dispatch(boost::posix_time::microsec_clock::universal_time());
+}
+
+void reconnect_scheduler::connected(host_id id)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  host& h = *hosts[id];
+  if (h.state == host_state::connecting)
+    --pending;
+  h.state = host_state::connected;
+  h.failures = 0;
+
+  dispatch(boost::posix_time::microsec_clock::universal_time());
+}
+
+void reconnect_scheduler::failed(host_id id, uint64_t last_timestamp)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  host& h = *hosts[id];
+  if (h.state == host_state::connecting)
+    --pending;
+  if (last_timestamp != 0)
+    h.last_timestamp = last_timestamp;
+
+  // Exponential backoff with "equal jitter": half of the delay is fixed, the
+  // other half random.
+  const unsigned shift = std::min(h.failures, 20u);
+  const int64_t max_ms = max_delay.total_milliseconds();
+  const int64_t delay_ms = std::min(initial_delay.total_milliseconds() << shift, max_ms);
+  const int64_t jitter_ms = std::uniform_int_distribution<int64_t>(0, delay_ms / 2)(random);
+  ++h.failures;
+
+  const auto now = boost::posix_time::microsec_clock::universal_time();
+  h.state = host_state::backoff;
+  h.next_attempt = now + boost::posix_time::milliseconds(delay_ms - delay_ms / 2 + jitter_ms);
+
+  dispatch(now);
+}
+
+void reconnect_scheduler::dispatch(boost::posix_time::ptime now)
+{
+  for (auto&& h : hosts)
+  {
+    if (h->state == host_state::backoff && h->next_attempt <= now)
+      h->state = host_state::queued;
+  }
+
+  while (pending < max_pending)
+  {
+    host* next = nullptr;
+    for (auto&& h : hosts)
+    {
+      if (h->state == host_state::queued && (next == nullptr || h->last_timestamp < next->last_timestamp))
+        next = h.get();
+    }
+    if (next == nullptr)
+      break;
+
+    next->state = host_state::connecting;
+    ++next->attempts;
+    ++pending;
+    next->io_service.post(next->connect);
+  }
+
+  schedule_timer();
+}
+
+void reconnect_scheduler::schedule_timer()
+{
+  boost::posix_time::ptime expiry;
+  for (auto&& h : hosts)
+  {
+    if (h->state == host_state::backoff && (expiry.is_not_a_date_time() || h->next_attempt < expiry))
+      expiry = h->next_attempt;
+  }
+
+  if (expiry.is_not_a_date_time() || expiry == timer_expiry)
+    return;
+
+  timer_expiry = expiry;
+  timer.expires_at(expiry);
+  timer.async_wait(boost::bind(&reconnect_scheduler::on_timer, this, _1));
+}
+
+void reconnect_scheduler::on_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  timer_expiry = boost::posix_time::ptime();
+  dispatch(boost::posix_time::microsec_clock::universal_time());
+}
+
+std::vector<reconnect_scheduler::host_status> reconnect_scheduler::status()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::vector<host_status> result;
+  result.reserve(hosts.size());
+  for (auto&& h : hosts)
+  {
+    result.push_back(host_status{h->name, h->state, h->failures, h->attempts, h->next_attempt});
+  }
+  return result;
+}
+
+std::string reconnect_scheduler::report()
+{
+  const auto state_name = [](host_state state) {
+    switch (state)
+    {
+      case host_state::backoff:
+        return "backoff";
+      case host_state::queued:
+        return "queued";
+      case host_state::connecting:
+        return "connecting";
+      case host_state::connected:
+        return "connected";
+    }
+    return "";
+  };
+
+  std::string out;
+  for (auto&& h : status())
+  {
+    out += (boost::format("host %1% state %2% failures %3% attempts %4%") % h.name % state_name(h.state) % h.failures % h.attempts).str();
+    if (h.state == host_state::backoff)
+      out += " next_attempt " + boost::posix_time::to_iso_extended_string(h.next_attempt);
+    out += '\n';
+  }
+  return out;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+// Decides when remote readers may resolve and connect.
+//
+// After a failure a host waits before its next attempt. The delay doubles
+// with every consecutive failure up to max_delay, and a random part of it
+// keeps hosts which failed together from retrying together. At most
+// max_pending hosts resolve or connect at the same time; the others wait in
+// line and the one whose last entry is oldest goes first.
+//
+// Hosts may call in from any thread. Their attempts are started on the
+// io_service they were added with.
+class reconnect_scheduler
+{
+public:
+  using host_id = size_t;
+
+  enum class host_state
+  {
+    // Waiting for the delay after a failure to pass.
+    backoff,
+    // Waiting for a free slot.
+    queued,
+    // Resolving, connecting or waiting for the response header.
+    connecting,
+    connected
+  };
+
+  struct host_status
+  {
+    std::string name;
+    host_state state;
+    // Consecutive failed attempts.
+    unsigned failures;
+    // Total connection attempts.
+    uint64_t attempts;
+    // When a host in backoff may try again.
+    boost::posix_time::ptime next_attempt;
+  };
+
+private:
+  struct host
+  {
+    std::string name;
+    boost::asio::io_service& io_service;
+    std::function<void()> connect;
+    host_state state = host_state::connected;
+    unsigned failures = 0;
+    uint64_t attempts = 0;
+    boost::posix_time::ptime next_attempt;
+    // __REALTIME_TIMESTAMP of the last entry received, 0 if none.
+    uint64_t last_timestamp = 0;
+
+    host(const std::string& name, boost::asio::io_service& io_service, std::function<void()> connect)
+      : name(name)
+      , io_service(io_service)
+      , connect(std::move(connect))
+    {
+    }
+  };
+
+  const boost::posix_time::time_duration initial_delay;
+  const boost::posix_time::time_duration max_delay;
+  const size_t max_pending;
+  boost::asio::deadline_timer timer;
+  boost::posix_time::ptime timer_expiry;
+  std::vector<std::unique_ptr<host>> hosts;
+  size_t pending = 0;
+  std::minstd_rand random;
+  std::mutex mutex;
+
+  void dispatch(boost::posix_time::ptime now);
+  void schedule_timer();
+  void on_timer(const boost::system::error_code& ec);
+
+public:
+  reconnect_scheduler(boost::asio::io_service& io_service, boost::posix_time::time_duration initial_delay, boost::posix_time::time_duration max_delay, size_t max_pending);
+
+  // Registers a host. connect is called whenever it may start an attempt.
+  host_id add_host(const std::string& name, boost::asio::io_service& io_service, std::function<void()> connect);
+
+  // Queues an attempt without delay, e.g. after the server ended a response.
+  void request(host_id id);
+
+  // Ends the current attempt successfully and resets the delay.
+  void connected(host_id id);
+
+  // Ends the current attempt or connection and queues the next one after
+  // the delay. last_timestamp is the __REALTIME_TIMESTAMP of the last entry
+  // received from the host, 0 if unknown.
+  void failed(host_id id, uint64_t last_timestamp);
+
+  std::vector<host_status> status();
+
+  // status() as text with one line per host, for the metrics report.
+  std::string report();
+};
@@ -1,46 +1,139 @@
 #include <systemd/sd-journal.h>
 
+#include <algorithm>
+#include <chrono>
+
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
-#include <boost/endian/conversion.hpp>
 
 #include "remote_journal_reader.h"
 
-remote_journal_reader::remote_journal_reader(boost::asio::io_service& io_service, const std::string& path, const std::string& address, outputter& out)
+namespace
+{
+// Number of bytes requested from the socket per read.
+const size_t read_size = 64 * 1024;
+// While catching up the data is already waiting at the server, so larger
+// reads mean fewer handler invocations per entry.
+const size_t catch_up_read_size = 1024 * 1024;
+
+// Time allowed from resolving to the response header.
+const boost::posix_time::time_duration connect_timeout = boost::posix_time::seconds(10);
+
+// Splits "host", "host:port" or "[address]:port" into a resolver query.
+boost::asio::ip::tcp::resolver::query make_query(const std::string& address)
+{
+  std::string host = address;
+  std::string port = "19531";
+
+  if (!address.empty() && address[0] == '[')
+  {
+    const auto end = address.find(']');
+    if (end != std::string::npos)
+    {
+      host = address.substr(1, end - 1);
+      if (end + 1 < address.size() && address[end + 1] == ':')
+        port = address.substr(end + 2);
+    }
+  }
+  else if (std::count(address.begin(), address.end(), ':') == 1)
+  {
+    const auto colon = address.find(':');
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+  }
+
+  return boost::asio::ip::tcp::resolver::query(host, port);
+}
+}
+
+remote_journal_reader::remote_journal_reader(boost::asio::io_service& io_service, checkpoint_manager& checkpoints, reconnect_scheduler& scheduler, metrics& stats, const journal_filter& filter, const std::vector<std::string>& projection, size_t catch_up_chunk, const std::string& address, entry_sink& out)
   : resolver(io_service)
   , socket(io_service)
+  , deadline(io_service)
   , out(out)
-  , query(address, "19531")
+  , query(make_query(address))
+  , checkpoints(checkpoints)
+  , checkpoint(checkpoints.add_source(address))
+  , scheduler(scheduler)
+  , scheduled_host(scheduler.add_host(address, io_service, [this]() { resolve(); }))
+  , source_metrics(stats.add_source(address))
+  , filter_parameters(filter.query_string())
+  , catch_up_chunk(catch_up_chunk)
+  // Without a stored cursor there is no backlog to catch up on.
+  , catching_up(catch_up_chunk > 0 && !checkpoints.cursor(checkpoint).empty())
 {
-  const std::string file_path = path + "/" + address;
-  file.open(file_path, std::fstream::in | std::fstream::out);
-  if (file.fail())
+  entry.set_source(checkpoint);
+  parser.set_projection(projection);
+  scheduler.request(scheduled_host);
+}
+
+void remote_journal_reader::start()
+{
+  if (reuse_connection && socket.is_open())
   {
-    file.open(file_path, std::fstream::in | std::fstream::out | std::fstream::trunc);
+    reuse_connection = false;
+    start_deadline();
+    send_request();
+    return;
   }
 
-  file >> cursor;
+  reuse_connection = false;
+  scheduler.request(scheduled_host);
+}
 
-  start();
+void remote_journal_reader::fail()
+{
+  ++attempt;
+  deadline.expires_at(boost::posix_time::pos_infin);
+  socket.close();
+  reuse_connection = false;
+  // The host may have logged a backlog during the outage. Without a cursor
+  // send_request follows right away.
+  catching_up = catch_up_chunk > 0;
+  source_metrics.reconnects.add(1);
+  scheduler.failed(scheduled_host, entry.realtime_usec());
 }
 
-void remote_journal_reader::start()
+void remote_journal_reader::start_deadline()
+{
+  deadline.expires_from_now(connect_timeout);
+  deadline.async_wait(boost::bind(&remote_journal_reader::on_deadline, this, attempt, _1));
+}
+
+void remote_journal_reader::on_deadline(uint64_t handler_attempt, const boost::system::error_code& ec)
 {
-  resolver.async_resolve(query, boost::bind(&remote_journal_reader::resolved, this, _1, _2));
+  if (handler_attempt != attempt || ec == boost::asio::error::operation_aborted || deadline.expires_at() > boost::asio::deadline_timer::traits_type::now())
+    return;
+
+  sd_journal_print(LOG_ERR, "Timed out connecting to '%s'", query.host_name().c_str());
+  // fail() makes the pending handlers ignore their completions.
+  resolver.cancel();
+  fail();
 }
 
-void remote_journal_reader::resolved(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator iterator)
+void remote_journal_reader::resolve()
 {
+  start_deadline();
+  resolver.async_resolve(query, boost::bind(&remote_journal_reader::resolved, this, attempt, _1, _2));
+}
+
+void remote_journal_reader::resolved(uint64_t handler_attempt, const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator iterator)
+{
+  if (handler_attempt != attempt)
+    return;
+
   if (ec)
   {
     sd_journal_print(LOG_ERR, "Error resolving address '%s': %s", query.host_name().c_str(), ec.message().c_str());
+    fail();
     return;
   }
 
   if (iterator == boost::asio::ip::tcp::resolver::iterator())
   {
     sd_journal_print(LOG_ERR, "Resolving host '%s' returned no results.", query.host_name().c_str());
+    fail();
     return;
   }
 
@@ -50,11 +143,14 @@ void remote_journal_reader::resolved(const boost::system::error_code& ec, boost:
 
 void remote_journal_reader::connect(boost::asio::ip::tcp::resolver::iterator next_iterator)
 {
-  socket.async_connect(endpoint, boost::bind(&remote_journal_reader::handle_connect, this, _1, next_iterator));
+  socket.async_connect(endpoint, boost::bind(&remote_journal_reader::handle_connect, this, attempt, _1, next_iterator));
 }
 
-void remote_journal_reader::handle_connect(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator next_iterator)
+void remote_journal_reader::handle_connect(uint64_t handler_attempt, const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator next_iterator)
 {
+  if (handler_attempt != attempt)
+    return;
+
   if (ec)
   {
     sd_journal_print(LOG_ERR, "Failed connecting to '%s' with error: %s", query.host_name().c_str(), ec.message().c_str());
@@ -69,160 +165,217 @@ void remote_journal_reader::handle_connect(const boost::system::error_code& ec,
     else
     {
       sd_journal_print(LOG_ERR, "Failed connecting to any address of host '%s'.", query.host_name().c_str());
+      fail();
     }
 
     return;
   }
 
-  boost::asio::streambuf request;
+  send_request();
+}
+
+void remote_journal_reader::send_request()
+{
+  std::string host = query.host_name();
+  if (host.find(':') != std::string::npos)
+    host = "[" + host + "]";
+
+  const std::string cursor = checkpoints.cursor(checkpoint);
+  // A cursor may only be missing if this host never sent anything.
+  catching_up = catching_up && !cursor.empty();
+
   std::ostream request_stream(&request);
-  request_stream << "GET /entries?boot&follow HTTP/1.0\r\n";
+  request_stream << "GET /entries?boot" << (catching_up ? "" : "&follow") << filter_parameters << " HTTP/1.1\r\n";
+  request_stream << "Host: " << host << ':' << query.service_name() << "\r\n";
   request_stream << "Accept: application/vnd.fdo.journal\r\n";
-  if (!cursor.empty())
+  request_stream << "Accept-Encoding: " << accepted_encodings() << "\r\n";
+  if (catching_up)
+  {
+    // Skip the entry of the cursor, which has already been shown.
+    request_stream << "Range: entries=" << cursor << ":1:" << catch_up_chunk << "\r\n";
+  }
+  else if (!cursor.empty())
   {
     request_stream << "Range: entries=" << cursor << "\r\n";
   }
   request_stream << "\r\n";
-  boost::asio::async_write(socket, request, boost::bind(&remote_journal_reader::handle_write_request, this, _1));
+  boost::asio::async_write(socket, request, boost::bind(&remote_journal_reader::handle_write_request, this, attempt, _1));
 }
 
-void remote_journal_reader::handle_write_request(const boost::system::error_code& ec)
+void remote_journal_reader::handle_write_request(uint64_t handler_attempt, const boost::system::error_code& ec)
 {
+  if (handler_attempt != attempt)
+    return;
+
   if (ec)
   {
-    std::stringstream remote_endpoint;
-    remote_endpoint << socket.remote_endpoint();
-    sd_journal_print(LOG_ERR, "Failed writing to '%s' with error: %s", remote_endpoint.str().c_str(), ec.message().c_str());
+    sd_journal_print(LOG_ERR, "Failed writing to '%s' with error: %s", query.host_name().c_str(), ec.message().c_str());
 
-    socket.close();
-    start();
+    fail();
     return;
   }
 
-  boost::asio::async_read_until(socket, response, "\r\n\r\n", boost::bind(&remote_journal_reader::handle_read_header, this, _1));
+  boost::asio::async_read_until(socket, response, "\r\n\r\n", boost::bind(&remote_journal_reader::handle_read_header, this, attempt, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
 }
 
-void remote_journal_reader::handle_read_header(const boost::system::error_code& ec)
+void remote_journal_reader::handle_read_header(uint64_t handler_attempt, const boost::system::error_code& ec, size_t bytes_transferred)
 {
+  if (handler_attempt != attempt)
+    return;
+
+  // Also makes a deadline handler which is already due do nothing.
+  deadline.expires_at(boost::posix_time::pos_infin);
+
   if (ec)
   {
-    std::stringstream remote_endpoint;
-    remote_endpoint << socket.remote_endpoint();
-    sd_journal_print(LOG_ERR, "Failed reading from '%s' with error: %s", remote_endpoint.str().c_str(), ec.message().c_str());
+    sd_journal_print(LOG_ERR, "Failed reading from '%s' with error: %s", query.host_name().c_str(), ec.message().c_str());
 
-    socket.close();
-    start();
+    fail();
     return;
   }
 
-  response.consume(response.size());
-
-  boost::asio::async_read_until(socket, response, '\n', boost::bind(&remote_journal_reader::handle_read, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-}
+  source_metrics.bytes.add(response.size());
 
-void remote_journal_reader::update_cursor(const std::string& cursor)
-{
-  this->cursor = cursor;
-  file.clear();
-  file.seekp(0);
-  file << cursor;
-  file.flush();
-}
+  std::string error;
+  const boost::string_view header(boost::asio::buffer_cast<const char*>(response.data()), bytes_transferred);
+  if (!http_response_header::parse(header, response_header, error))
+  {
+    sd_journal_print(LOG_ERR, "Received malformed response from '%s': %s", query.host_name().c_str(), error.c_str());
+    fail();
+    return;
+  }
 
-void remote_journal_reader::handle_read(const boost::system::error_code& ec, size_t bytes_transferred)
-{
-  if (ec)
+  if (response_header.status != 200)
   {
-    std::stringstream remote_endpoint;
-    remote_endpoint << socket.remote_endpoint();
-    sd_journal_print(LOG_ERR, "Failed reading from '%s' with error: %s", remote_endpoint.str().c_str(), ec.message().c_str());
-    socket.close();
-    start();
+    sd_journal_print(LOG_ERR, "Request to '%s' failed with status %d", query.host_name().c_str(), response_header.status);
+    fail();
     return;
   }
 
-  std::string line(boost::asio::buffers_begin(response.data()), boost::asio::buffers_begin(response.data()) + bytes_transferred);
+  scheduler.connected(scheduled_host);
 
-  if (line == "\n")
-  {
-    response.consume(bytes_transferred);
+  response_entries = 0;
 
-    {
-      auto it = values.find("__CURSOR");
-      if (it != values.end())
-      {
-        update_cursor(it->second);
-      }
-    }
+  // The header read may already contain the beginning of the body.
+  response.consume(bytes_transferred);
+  parser.reset();
+  decoder.reset(response_header);
 
-    out.add_line(values);
+  const char* body = boost::asio::buffer_cast<const char*>(response.data());
+  http_body_decoder::result result = http_body_decoder::result::more;
+  if (decoder.passthrough())
+    parser.append(body, response.size());
+  else
+    result = decoder.decode(body, response.size(), parser);
+  response.consume(response.size());
 
-    values.clear();
+  handle_body(result);
+}
 
-    boost::asio::async_read_until(socket, response, '\n', boost::bind(&remote_journal_reader::handle_read, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-    return;
+void remote_journal_reader::async_read_entries()
+{
+  const size_t size = catching_up ? catch_up_read_size : read_size;
+  if (decoder.passthrough())
+  {
+    socket.async_read_some(parser.prepare(size), boost::bind(&remote_journal_reader::handle_read, this, attempt, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
   }
+  else
+  {
+    read_buffer.resize(size);
+    socket.async_read_some(boost::asio::buffer(read_buffer), boost::bind(&remote_journal_reader::handle_read, this, attempt, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+  }
+}
 
-  size_t pos = line.find('=');
+void remote_journal_reader::handle_read(uint64_t handler_attempt, const boost::system::error_code& ec, size_t bytes_transferred)
+{
+  if (handler_attempt != attempt)
+    return;
 
-  if (pos == std::string::npos)
+  if (ec == boost::asio::error::eof && catching_up && decoder.passthrough())
   {
-    // No equal sign, this field is serialized in a binary safe way.
+    // Without a length the server ends a bounded response by closing.
+    response_header.keep_alive = false;
+    handle_body(http_body_decoder::result::complete);
+    return;
+  }
 
-    binary_field_name = line.substr(0, line.size() - 1);
+  if (ec)
+  {
+    sd_journal_print(LOG_ERR, "Failed reading from '%s' with error: %s", query.host_name().c_str(), ec.message().c_str());
+    fail();
+    return;
+  }
 
-    response.consume(bytes_transferred);
+  source_metrics.bytes.add(bytes_transferred);
 
-    boost::asio::async_read(socket, response, boost::asio::transfer_exactly(8), boost::bind(&remote_journal_reader::handle_read_binary_length, this, _1));
+  if (decoder.passthrough())
+  {
+    parser.commit(bytes_transferred);
+    handle_body(http_body_decoder::result::more);
   }
   else
   {
-    // Normal field.
-    values[line.substr(0, pos)] = line.substr(pos+1, line.size()-pos-1-1);
-
-    response.consume(bytes_transferred);
-
-    boost::asio::async_read_until(socket, response, '\n', boost::bind(&remote_journal_reader::handle_read, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    handle_body(decoder.decode(read_buffer.data(), bytes_transferred, parser));
   }
 }
 
-void remote_journal_reader::handle_read_binary_length(const boost::system::error_code& ec)
+void remote_journal_reader::handle_body(http_body_decoder::result result)
 {
-  if (ec)
+  if (result == http_body_decoder::result::error)
   {
-    std::stringstream remote_endpoint;
-    remote_endpoint << socket.remote_endpoint();
-    sd_journal_print(LOG_ERR, "Failed reading length of binary journal entry field from '%s' with error: %s", remote_endpoint.str().c_str(), ec.message().c_str());
-    socket.close();
-    start();
+    sd_journal_print(LOG_ERR, "Failed decoding response from '%s': %s", query.host_name().c_str(), decoder.error().c_str());
+    fail();
     return;
   }
 
-  const uint64_t* pointer = boost::asio::buffer_cast<const uint64_t*>(response.data());
-  uint64_t size = *pointer;
-  boost::endian::little_to_native_inplace(size);
+  const auto parse_start = std::chrono::steady_clock::now();
+  const uint64_t entries_before = source_metrics.entries.get();
+  const bool parsed = parser.parse([this](const std::vector<export_parser::field>& fields) { handle_entry(fields); });
+  source_metrics.parse_latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - parse_start).count());
+  if (source_metrics.entries.get() != entries_before)
+    source_metrics.received(entry.realtime_usec());
 
-  response.consume(8);
-
-  boost::asio::async_read(socket, response, boost::asio::transfer_exactly(size), boost::bind(&remote_journal_reader::handle_read_binary, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-}
+  if (!parsed)
+  {
+    sd_journal_print(LOG_ERR, "Received malformed journal entry from '%s'", query.host_name().c_str());
+    fail();
+    return;
+  }
 
-void remote_journal_reader::handle_read_binary(const boost::system::error_code& ec, size_t bytes_transferred)
-{
-  if (ec)
+  if (result == http_body_decoder::result::complete)
   {
-    std::stringstream remote_endpoint;
-    remote_endpoint << socket.remote_endpoint();
-    sd_journal_print(LOG_ERR, "Failed reading binary journal entry field from '%s' with error: %s", remote_endpoint.str().c_str(), ec.message().c_str());
-    socket.close();
+    // A chunk which was not filled up reached the end of the journal, so
+    // new entries are followed from now on.
+    if (catching_up && response_entries < catch_up_chunk)
+      catching_up = false;
+
+    // The server ended the response, continue from the last cursor.
+    if (response_header.keep_alive)
+      reuse_connection = true;
+    else
+      socket.close();
     start();
     return;
   }
 
-  // Ignore binary fields.
-  response.consume(bytes_transferred);
-
-  boost::asio::async_read_until(socket, response, '\n', boost::bind(&remote_journal_reader::handle_read, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+  async_read_entries();
 }
 
+void remote_journal_reader::handle_entry(const std::vector<export_parser::field>& fields)
+{
+  entry.clear();
 
+  for (auto&& field : fields)
+  {
+    entry.add(field.name, field.value);
+  }
+
+  if (entry.has(well_known_field::cursor))
+  {
+    checkpoints.update(checkpoint, entry.get(well_known_field::cursor));
+  }
+
+  ++response_entries;
+  source_metrics.entries.add(1);
+  out.add_line(entry);
+}
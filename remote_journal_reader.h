@@ -1,44 +1,98 @@
 #pragma once
 
-#include <fstream>
-
 #include <boost/asio.hpp>
 
-#include "outputter.h"
+#include "checkpoint_manager.h"
+#include "export_parser.h"
+#include "http_response.h"
+#include "reconnect_scheduler.h"
+#include "journal_filter.h"
+#include "metrics.h"
+#include "entry_sink.h"
 
+// Follows the journal of a host running systemd-journal-gatewayd.
+//
+// Requests are made with HTTP/1.1 and accept compressed responses. After a
+// response ended normally, the next request reuses the connection. New
+// connections are only made when the reconnect_scheduler allows it. An
+// attempt which does not get to the response header within a deadline is
+// given up, so an unreachable host does not hold a connecting slot of the
+// scheduler until the kernel gives up on it.
+//
+// When resuming from a stored cursor or reconnecting after a failure, the
+// backlog is first fetched without following, in bounded requests of catch_up_chunk entries read with large
+// socket reads. Once a request returns fewer entries the journal is
+// followed as usual.
 class remote_journal_reader
 {
   boost::asio::ip::tcp::resolver resolver;
   boost::asio::ip::tcp::socket socket;
+  // Bounds resolving, connecting and waiting for the response header.
+  boost::asio::deadline_timer deadline;
+  boost::asio::streambuf request;
   boost::asio::streambuf response;
-  outputter& out;
+  http_response_header response_header;
+  http_body_decoder decoder;
+  // Receives the body if it has to be decoded before parsing.
+  std::vector<char> read_buffer;
+  bool reuse_connection = false;
+  entry_sink& out;
   boost::asio::ip::tcp::resolver::query query;
   boost::asio::ip::tcp::endpoint endpoint;
-  std::map<std::string, std::string> values;
-  std::string binary_field_name;
-  std::fstream file;
-  std::string cursor;
+  export_parser parser;
+  journal_entry entry;
+  checkpoint_manager& checkpoints;
+  checkpoint_manager::source_id checkpoint;
+  reconnect_scheduler& scheduler;
+  reconnect_scheduler::host_id scheduled_host;
+  metrics::source& source_metrics;
+  const std::string filter_parameters;
+  const size_t catch_up_chunk;
+  bool catching_up;
+  // Entries received in the current response.
+  size_t response_entries = 0;
+  // Counts the attempts given up by fail(). Handlers carry the value they
+  // were started with and ignore completions of an abandoned attempt.
+  uint64_t attempt = 0;
 
+  // Sends the next request, on a new connection if the last one ended.
   void start();
 
-  void resolved(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator iterator);
+  // Closes the connection and lets the scheduler retry later.
+  void fail();
+
+  void resolve();
+
+  void start_deadline();
+
+  void on_deadline(uint64_t handler_attempt, const boost::system::error_code& ec);
+
+  void resolved(uint64_t handler_attempt, const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator iterator);
 
   void connect(boost::asio::ip::tcp::resolver::iterator next_iterator);
 
-  void handle_connect(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator next_iterator);
+  void handle_connect(uint64_t handler_attempt, const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator next_iterator);
+
+  void send_request();
 
-  void handle_write_request(const boost::system::error_code& ec);
+  void handle_write_request(uint64_t handler_attempt, const boost::system::error_code& ec);
 
-  void handle_read_header(const boost::system::error_code& ec);
+  void handle_read_header(uint64_t handler_attempt, const boost::system::error_code& ec, size_t bytes_transferred);
 
-  void update_cursor(const std::string& cursor);
+  void async_read_entries();
 
-  void handle_read(const boost::system::error_code& ec, size_t bytes_transferred);
+  void handle_read(uint64_t handler_attempt, const boost::system::error_code& ec, size_t bytes_transferred);
 
-  void handle_read_binary_length(const boost::system::error_code& ec);
+  void handle_body(http_body_decoder::result result);
 
-  void handle_read_binary(const boost::system::error_code& ec, size_t bytes_transferred);
+  void handle_entry(const std::vector<export_parser::field>& fields);
 
 public:
-  remote_journal_reader(boost::asio::io_service& io_service, const std::string& path, const std::string& address, outputter& out);
+  remote_journal_reader(boost::asio::io_service& io_service, checkpoint_manager& checkpoints, reconnect_scheduler& scheduler, metrics& stats, const journal_filter& filter, const std::vector<std::string>& projection, size_t catch_up_chunk, const std::string& address, entry_sink& out);
+
+  // Bytes received from the network including headers, before decompression.
+  uint64_t bytes_received() const
+  {
+    return source_metrics.bytes.get();
+  }
 };
@@ -0,0 +1,258 @@
+#include "scrollback_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// usec, priority and host in front of the text.
+const size_t header_size = 8 + 1 + 2;
+
+// Longer lines are cut so a few always fit into a segment.
+const size_t max_text_size = scrollback_store::segment_size / 4;
+
+const size_t max_hosts = UINT16_MAX;
+}
+
+scrollback_store::scrollback_store(size_t max_bytes)
+  : segments(std::max<size_t>(max_bytes / segment_size, 2))
+{
+}
+
+const scrollback_store::segment& scrollback_store::segment_at(size_t age) const
+{
+  // age 0 is the oldest used segment.
+  return segments[(newest + segments.size() - used_segments + 1 + age) % segments.size()];
+}
+
+void scrollback_store::start_segment()
+{
+  if (used_segments > 0)
+    newest = (newest + 1) % segments.size();
+  if (used_segments < segments.size())
+    ++used_segments;
+
+  segment& current = segments[newest];
+  if (!current.data)
+    current.data.reset(new char[segment_size]);
+  current.data_size = 0;
+  current.count = 0;
+  current.first_line = next_line;
+  current.min_usec = UINT64_MAX;
+  current.max_usec = 0;
+  current.hosts = 0;
+  current.priorities = 0;
+}
+
+void scrollback_store::append(uint64_t usec, int priority, boost::string_view host, boost::string_view text)
+{
+  text = text.substr(0, max_text_size);
+
+  uint16_t host_id;
+  const auto host_it = host_index.find(host);
+  if (host_it != host_index.end())
+  {
+    host_id = host_it->second;
+  }
+  else if (host_names.size() == max_hosts)
+  {
+    host_id = static_cast<uint16_t>(max_hosts - 1);
+  }
+  else
+  {
+    host_id = static_cast<uint16_t>(host_names.size());
+    host_names.emplace_back(host.data(), host.size());
+    host_index.emplace(host_names.back(), host_id);
+  }
+
+  const size_t record_size = header_size + text.size();
+  if (used_segments == 0 || segments[newest].data_size + record_size + (segments[newest].count + 1) * sizeof(uint32_t) > segment_size)
+  {
+    start_segment();
+  }
+
+  segment& current = segments[newest];
+  const uint8_t priority_byte = static_cast<uint8_t>(std::min(std::max(priority, 0), 7));
+
+  char header[header_size];
+  std::memcpy(header, &usec, 8);
+  header[8] = static_cast<char>(priority_byte);
+  std::memcpy(header + 9, &host_id, 2);
+
+  ++current.count;
+  std::memcpy(current.data.get() + segment_size - current.count * sizeof(uint32_t), &current.data_size, sizeof(uint32_t));
+  std::memcpy(current.data.get() + current.data_size, header, header_size);
+  std::memcpy(current.data.get() + current.data_size + header_size, text.data(), text.size());
+  current.data_size += static_cast<uint32_t>(record_size);
+
+  current.min_usec = std::min(current.min_usec, usec);
+  current.max_usec = std::max(current.max_usec, usec);
+  current.hosts |= uint64_t(1) << (host_id % 64);
+  current.priorities |= static_cast<uint8_t>(1 << priority_byte);
+  ++next_line;
+}
+
+uint64_t scrollback_store::begin_line() const
+{
+  if (used_segments == 0)
+    return next_line;
+  return segment_at(0).first_line;
+}
+
+const scrollback_store::segment* scrollback_store::find_segment(uint64_t line) const
+{
+  if (line < begin_line() || line >= next_line)
+    return nullptr;
+
+  // Last segment starting at or before the line.
+  size_t low = 0;
+  size_t high = used_segments;
+  while (high - low > 1)
+  {
+    const size_t middle = (low + high) / 2;
+    if (segment_at(middle).first_line <= line)
+      low = middle;
+    else
+      high = middle;
+  }
+  return &segment_at(low);
+}
+
+uint32_t scrollback_store::offset(const segment& segment, size_t index)
+{
+  uint32_t result;
+  std::memcpy(&result, segment.data.get() + segment_size - (index + 1) * sizeof(uint32_t), sizeof(uint32_t));
+  return result;
+}
+
+scrollback_store::line scrollback_store::decode(const segment& segment, size_t index) const
+{
+  const size_t begin = offset(segment, index);
+  const size_t end = index + 1 < segment.count ? offset(segment, index + 1) : segment.data_size;
+  const char* record = segment.data.get() + begin;
+
+  line result;
+  std::memcpy(&result.usec, record, 8);
+  result.priority = static_cast<uint8_t>(record[8]);
+  std::memcpy(&result.host, record + 9, 2);
+  result.text = boost::string_view(record + header_size, end - begin - header_size);
+  return result;
+}
+
+bool scrollback_store::get(uint64_t number, line& out) const
+{
+  const segment* segment = find_segment(number);
+  if (segment == nullptr)
+    return false;
+
+  out = decode(*segment, number - segment->first_line);
+  return true;
+}
+
+int scrollback_store::find_host(boost::string_view name) const
+{
+  const auto it = host_index.find(name);
+  if (it == host_index.end())
+    return filter::any_host;
+  return it->second;
+}
+
+uint64_t scrollback_store::find_time(uint64_t usec) const
+{
+  // Lines of different hosts are not strictly ordered by time, so the first
+  // segment which reaches usec is searched line by line.
+  for (size_t age = 0; age < used_segments; ++age)
+  {
+    const segment& segment = segment_at(age);
+    if (segment.max_usec < usec)
+      continue;
+
+    for (size_t i = 0; i < segment.count; ++i)
+    {
+      if (decode(segment, i).usec >= usec)
+        return segment.first_line + i;
+    }
+  }
+  return next_line;
+}
+
+bool scrollback_store::may_match(const segment& segment, const filter& filter) const
+{
+  if ((segment.priorities & ((2 << filter.max_priority) - 1)) == 0)
+    return false;
+  if (filter.host != filter::any_host && (segment.hosts & (uint64_t(1) << (filter.host % 64))) == 0)
+    return false;
+  return true;
+}
+
+scrollback_store::search_result scrollback_store::find(uint64_t& number, bool backwards, const filter& filter, const std::function<bool(const line&)>& predicate, size_t budget) const
+{
+  while (budget > 0)
+  {
+    const segment* segment = find_segment(number);
+    if (segment == nullptr)
+      return search_result::not_found;
+
+    const uint64_t segment_end = segment->first_line + segment->count;
+
+    if (!may_match(*segment, filter))
+    {
+      // Skip the whole segment.
+      --budget;
+      if (backwards)
+      {
+        if (segment->first_line == 0)
+          return search_result::not_found;
+        number = segment->first_line - 1;
+      }
+      else
+      {
+        number = segment_end;
+      }
+      continue;
+    }
+
+    while (budget > 0)
+    {
+      --budget;
+      const line current = decode(*segment, number - segment->first_line);
+      if (filter.matches(current) && (!predicate || predicate(current)))
+        return search_result::found;
+
+      if (backwards)
+      {
+        if (number == segment->first_line)
+        {
+          if (number == 0)
+            return search_result::not_found;
+          --number;
+          break;
+        }
+        --number;
+      }
+      else
+      {
+        ++number;
+        if (number == segment_end)
+          break;
+      }
+    }
+  }
+
+  return search_result::interrupted;
+}
+
+size_t scrollback_store::memory_used() const
+{
+  size_t result = segments.capacity() * sizeof(segment);
+  for (auto&& segment : segments)
+  {
+    if (segment.data)
+      result += segment_size;
+  }
+  for (auto&& name : host_names)
+  {
+    result += name.capacity();
+  }
+  return result;
+}
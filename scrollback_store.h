@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/utility/string_view.hpp>
+
+#include "string_view_hash.h"
+
+// Keeps the most recent displayed lines within a fixed amount of memory.
+//
+// Lines are encoded into segments of segment_size bytes which are used as a
+// ring: once all are full the oldest one is cleared and reused. Like a
+// slotted page, records grow from the front of a segment and their offsets
+// from the back, so a segment never needs more than its one allocation.
+// Each segment records the time range, hosts and priorities of its lines, so
+// lookups by time and filtered scans can skip whole segments.
+//
+// Lines are numbered in the order they were appended, starting at 0.
+class scrollback_store
+{
+public:
+  struct line
+  {
+    uint64_t usec;
+    int priority;
+    uint16_t host;
+    boost::string_view text;
+  };
+
+  // Restricts lines to a host and a maximum priority.
+  struct filter
+  {
+    static const int any_host = -1;
+
+    int host = any_host;
+    int max_priority = 7;
+
+    bool matches(const line& line) const
+    {
+      return line.priority <= max_priority && (host == any_host || line.host == host);
+    }
+  };
+
+  enum class search_result
+  {
+    found,
+    not_found,
+    // The budget was used up, continue the search from the returned line.
+    interrupted
+  };
+
+  static const size_t segment_size = 1024 * 1024;
+
+private:
+  struct segment
+  {
+    std::unique_ptr<char[]> data;
+    // End of the last record.
+    uint32_t data_size = 0;
+    uint32_t count = 0;
+    uint64_t first_line = 0;
+    uint64_t min_usec = 0;
+    uint64_t max_usec = 0;
+    // Bit host % 64 is set if a line of the host is stored.
+    uint64_t hosts = 0;
+    // Bit n is set if a line with priority n is stored.
+    uint8_t priorities = 0;
+  };
+
+  std::vector<segment> segments;
+  size_t newest = 0;
+  size_t used_segments = 0;
+  uint64_t next_line = 0;
+  // A deque never moves its elements, so the keys of the index can point into it.
+  std::deque<std::string> host_names;
+  std::unordered_map<boost::string_view, uint16_t, string_view_hash> host_index;
+
+  const segment& segment_at(size_t age) const;
+  const segment* find_segment(uint64_t line) const;
+  bool may_match(const segment& segment, const filter& filter) const;
+  static uint32_t offset(const segment& segment, size_t index);
+  line decode(const segment& segment, size_t index) const;
+  void start_segment();
+
+public:
+  // Keeps as many segments as fit into max_bytes, but at least two.
+  explicit scrollback_store(size_t max_bytes);
+
+  void append(uint64_t usec, int priority, boost::string_view host, boost::string_view text);
+
+  // Number of the oldest line which is still stored.
+  uint64_t begin_line() const;
+
+  // Number the next appended line will get.
+  uint64_t end_line() const
+  {
+    return next_line;
+  }
+
+  // Returns false if the line was never stored or has already been dropped.
+  bool get(uint64_t number, line& out) const;
+
+  // Returns the host id of name or -1 if no line of the host was stored.
+  int find_host(boost::string_view name) const;
+
+  boost::string_view host_name(uint16_t host) const
+  {
+    return host_names[host];
+  }
+
+  // Returns the first line with a timestamp at or after usec, or end_line()
+  // if there is none.
+  uint64_t find_time(uint64_t usec) const;
+
+  // Looks for a line matching filter and predicate, starting at number and
+  // moving to older lines if backwards is set or newer ones otherwise. At
+  // most budget lines are inspected; number is updated to the match or to
+  // where the search has to continue. predicate may be empty.
+  search_result find(uint64_t& number, bool backwards, const filter& filter, const std::function<bool(const line&)>& predicate, size_t budget) const;
+
+  // Bytes currently allocated and the limit given on construction.
+  size_t memory_used() const;
+  size_t memory_limit() const
+  {
+    return segments.size() * segment_size;
+  }
+};
@@ -0,0 +1,516 @@
+#include "scrollback_view.h"
+
+#include <systemd/sd-journal.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <boost/bind.hpp>
+
+// Included last as its macros clash with asio.
+#include <ncurses.h>
+
+namespace
+{
+// Lines inspected per search step before entries are read again.
+const size_t search_budget = 100000;
+
+// Budget for finding the lines of a page, which only exceeds it if a filter
+// leaves very few lines.
+const size_t page_budget = 10 * 1000 * 1000;
+
+const int escape = 27;
+
+int priority_color(int priority)
+{
+  if (priority <= 3)
+    return 1;
+  if (priority == 4)
+    return 2;
+  if (priority == 7)
+    return 3;
+  return 0;
+}
+}
+
+scrollback_view::scrollback_view(boost::asio::io_service& io_service, const scrollback_store& store)
+  : io_service(io_service)
+  , store(store)
+  , input(io_service)
+{
+  getmaxyx(stdscr, row, col);
+
+  if (!isatty(STDIN_FILENO))
+    return;
+
+  boost::system::error_code ec;
+  input.assign(dup(STDIN_FILENO), ec);
+  if (ec)
+  {
+    sd_journal_print(LOG_ERR, "Failed reading keyboard input: %s", ec.message().c_str());
+    return;
+  }
+
+  keypad(stdscr, TRUE);
+  nodelay(stdscr, TRUE);
+  set_escdelay(25);
+  wait_for_input();
+}
+
+scrollback_view::~scrollback_view()
+{
+  if (window != nullptr)
+    delwin(window);
+}
+
+void scrollback_view::wait_for_input()
+{
+  input.async_wait(boost::asio::posix::descriptor_base::wait_read, boost::bind(&scrollback_view::handle_input, this, boost::asio::placeholders::error));
+}
+
+void scrollback_view::handle_input(const boost::system::error_code& ec)
+{
+  if (ec)
+  {
+    if (ec != boost::asio::error::operation_aborted)
+      sd_journal_print(LOG_ERR, "Failed reading keyboard input: %s", ec.message().c_str());
+    return;
+  }
+
+  int key;
+  while ((key = wgetch(active() ? window : stdscr)) != ERR)
+  {
+    handle_key(key);
+  }
+
+  wait_for_input();
+}
+
+void scrollback_view::handle_key(int key)
+{
+  if (!active())
+  {
+    switch (key)
+    {
+      case KEY_PPAGE:
+      case KEY_UP:
+      case 'k':
+        open();
+        break;
+      case '/':
+        open();
+        if (active())
+          prompt = prompt_type::substring;
+        break;
+      default:
+        return;
+    }
+
+    if (active())
+      draw();
+    return;
+  }
+
+  if (prompt != prompt_type::none)
+  {
+    handle_prompt_key(key);
+    return;
+  }
+
+  message.clear();
+  const long page = std::max(row - 1, 1);
+
+  switch (key)
+  {
+    case KEY_PPAGE:
+    case 'b':
+      scroll_by(-page);
+      break;
+    case KEY_NPAGE:
+    case 'f':
+    case ' ':
+      scroll_by(page);
+      break;
+    case KEY_UP:
+    case 'k':
+      scroll_by(-1);
+      break;
+    case KEY_DOWN:
+    case 'j':
+      scroll_by(1);
+      break;
+    case KEY_HOME:
+    case 'g':
+      move_to(store.begin_line());
+      scroll_by(page - 1);
+      break;
+    case KEY_END:
+    case 'G':
+      move_to(store.end_line() - 1);
+      break;
+    case 'q':
+    case escape:
+      close();
+      return;
+    case '/':
+      prompt = prompt_type::substring;
+      break;
+    case 'r':
+      prompt = prompt_type::regex;
+      break;
+    case 'n':
+      start_search(true);
+      break;
+    case 'N':
+      start_search(false);
+      break;
+    case 'h':
+      prompt = prompt_type::host;
+      break;
+    case 't':
+      prompt = prompt_type::time;
+      break;
+    case 'a':
+      filter = scrollback_store::filter();
+      move_to(bottom);
+      break;
+    default:
+      if (key >= '0' && key <= '7')
+      {
+        filter.max_priority = key - '0';
+        move_to(bottom);
+      }
+      break;
+  }
+
+  draw();
+}
+
+void scrollback_view::handle_prompt_key(int key)
+{
+  switch (key)
+  {
+    case '\n':
+    case KEY_ENTER:
+      submit_prompt();
+      prompt = prompt_type::none;
+      prompt_text.clear();
+      draw();
+      return;
+    case escape:
+      prompt = prompt_type::none;
+      prompt_text.clear();
+      break;
+    case KEY_BACKSPACE:
+    case 127:
+    case '\b':
+      if (!prompt_text.empty())
+        prompt_text.pop_back();
+      break;
+    default:
+      if (key >= ' ' && key < 127)
+        prompt_text += static_cast<char>(key);
+      break;
+  }
+
+  draw_status();
+  wrefresh(window);
+}
+
+void scrollback_view::submit_prompt()
+{
+  switch (prompt)
+  {
+    case prompt_type::none:
+      break;
+    case prompt_type::substring:
+    case prompt_type::regex:
+      if (prompt_text.empty())
+        break;
+
+      if (prompt == prompt_type::regex)
+      {
+        try
+        {
+          search_regex = std::regex(prompt_text, std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error& e)
+        {
+          message = "Invalid regular expression: " + std::string(e.what());
+          break;
+        }
+      }
+
+      search_is_regex = prompt == prompt_type::regex;
+      search_text = prompt_text;
+      highlighted = UINT64_MAX;
+      start_search(true);
+      break;
+    case prompt_type::host:
+      if (prompt_text.empty())
+      {
+        filter.host = scrollback_store::filter::any_host;
+      }
+      else
+      {
+        const int host = store.find_host(prompt_text);
+        if (host == scrollback_store::filter::any_host)
+        {
+          message = "No lines of host " + prompt_text;
+          break;
+        }
+        filter.host = host;
+      }
+      move_to(bottom);
+      break;
+    case prompt_type::time:
+      {
+        int hour, minute, second = 0;
+        if (std::sscanf(prompt_text.c_str(), "%d:%d:%d", &hour, &minute, &second) < 2)
+        {
+          message = "Expected HH:MM or HH:MM:SS";
+          break;
+        }
+
+        // The time refers to the day of the line currently shown.
+        scrollback_store::line current;
+        std::time_t time = std::time(nullptr);
+        if (store.get(bottom, current))
+          time = static_cast<std::time_t>(current.usec / 1000000);
+
+        std::tm local;
+        localtime_r(&time, &local);
+        local.tm_hour = hour;
+        local.tm_min = minute;
+        local.tm_sec = second;
+        local.tm_isdst = -1;
+        time = std::mktime(&local);
+
+        const uint64_t line = store.find_time(static_cast<uint64_t>(time) * 1000000);
+        if (line == store.end_line())
+        {
+          message = "No lines after " + prompt_text;
+          break;
+        }
+
+        highlighted = line;
+        move_to(line);
+        scroll_by(std::max(row - 2, 0));
+      }
+      break;
+  }
+}
+
+void scrollback_view::open()
+{
+  if (store.begin_line() == store.end_line())
+    return;
+
+  window = newwin(row, col, 0, 0);
+  keypad(window, TRUE);
+  nodelay(window, TRUE);
+  highlighted = UINT64_MAX;
+  move_to(store.end_line() - 1);
+}
+
+void scrollback_view::close()
+{
+  ++search_generation;
+  prompt = prompt_type::none;
+  prompt_text.clear();
+  message.clear();
+
+  delwin(window);
+  window = nullptr;
+
+  // Show the live screen, which was updated in the meantime.
+  touchwin(stdscr);
+  refresh();
+}
+
+void scrollback_view::move_to(uint64_t line)
+{
+  // Show the closest line passing the filter, preferring older ones.
+  line = std::max(std::min(line, store.end_line() - 1), store.begin_line());
+  uint64_t position = line;
+  if (store.find(position, true, filter, nullptr, page_budget) != scrollback_store::search_result::found)
+  {
+    position = line;
+    if (store.find(position, false, filter, nullptr, page_budget) != scrollback_store::search_result::found)
+    {
+      message = "No lines match the filter";
+      position = line;
+    }
+  }
+  bottom = position;
+}
+
+void scrollback_view::scroll_by(long lines)
+{
+  const bool backwards = lines < 0;
+  for (long i = 0; i < std::abs(lines); ++i)
+  {
+    if (backwards ? bottom <= store.begin_line() : bottom + 1 >= store.end_line())
+      break;
+
+    uint64_t position = backwards ? bottom - 1 : bottom + 1;
+    if (store.find(position, backwards, filter, nullptr, page_budget) != scrollback_store::search_result::found)
+      break;
+    bottom = position;
+  }
+}
+
+bool scrollback_view::matches(const scrollback_store::line& line) const
+{
+  if (search_is_regex)
+    return std::regex_search(line.text.begin(), line.text.end(), search_regex);
+  return memmem(line.text.data(), line.text.size(), search_text.data(), search_text.size()) != nullptr;
+}
+
+void scrollback_view::start_search(bool backwards)
+{
+  if (search_text.empty())
+  {
+    message = "No search pattern given, use / or r";
+    return;
+  }
+
+  search_backwards = backwards;
+  search_position = bottom;
+  if (highlighted != UINT64_MAX)
+  {
+    if (backwards ? highlighted == 0 : highlighted + 1 >= store.end_line())
+    {
+      message = "Pattern not found";
+      return;
+    }
+    search_position = backwards ? highlighted - 1 : highlighted + 1;
+  }
+
+  search_step(++search_generation);
+}
+
+void scrollback_view::search_step(unsigned generation)
+{
+  if (generation != search_generation || !active())
+    return;
+
+  const auto result = store.find(search_position, search_backwards, filter, [this](const scrollback_store::line& line) { return matches(line); }, search_budget);
+
+  switch (result)
+  {
+    case scrollback_store::search_result::found:
+      highlighted = search_position;
+      bottom = search_position;
+      message.clear();
+      break;
+    case scrollback_store::search_result::not_found:
+      message = "Pattern not found";
+      break;
+    case scrollback_store::search_result::interrupted:
+      message = "Searching at line " + std::to_string(search_position) + " ...";
+      io_service.post(boost::bind(&scrollback_view::search_step, this, generation));
+      break;
+  }
+
+  draw();
+}
+
+void scrollback_view::update()
+{
+  if (bottom < store.begin_line())
+    move_to(store.begin_line());
+  draw();
+}
+
+void scrollback_view::draw()
+{
+  werase(window);
+
+  // Collect the page from the bottom up. New lines do not change it, so it
+  // is only searched again after moving, filtering or losing old lines.
+  const bool page_valid = bottom == page_bottom && filter.host == page_filter.host && filter.max_priority == page_filter.max_priority
+    && (page.empty() || page.back() >= store.begin_line());
+  if (!page_valid)
+  {
+    page.clear();
+    page_bottom = bottom;
+    page_filter = filter;
+    uint64_t position = bottom;
+    while (page.size() < static_cast<size_t>(std::max(row - 1, 0)) && store.find(position, true, filter, nullptr, page_budget) == scrollback_store::search_result::found)
+    {
+      page.push_back(position);
+      if (position == 0)
+        break;
+      --position;
+    }
+  }
+  const std::vector<uint64_t>& lines = page;
+
+  int y = 0;
+  for (auto it = lines.rbegin(); it != lines.rend(); ++it, ++y)
+  {
+    scrollback_store::line line;
+    store.get(*it, line);
+
+    attr_t attributes = 0;
+    const int color = has_colors() ? priority_color(line.priority) : 0;
+    if (color != 0)
+      attributes |= COLOR_PAIR(color);
+    if (*it == highlighted)
+      attributes |= A_REVERSE;
+
+    wattron(window, attributes);
+    mvwaddnstr(window, y, 0, line.text.data(), static_cast<int>(std::min<size_t>(line.text.size(), col)));
+    wattroff(window, attributes);
+  }
+
+  draw_status();
+  wrefresh(window);
+}
+
+void scrollback_view::draw_status()
+{
+  std::string status;
+
+  switch (prompt)
+  {
+    case prompt_type::none:
+      break;
+    case prompt_type::substring:
+      status = "/" + prompt_text;
+      break;
+    case prompt_type::regex:
+      status = "regex: " + prompt_text;
+      break;
+    case prompt_type::host:
+      status = "host (empty for all): " + prompt_text;
+      break;
+    case prompt_type::time:
+      status = "time (HH:MM[:SS]): " + prompt_text;
+      break;
+  }
+
+  if (prompt == prompt_type::none)
+  {
+    char summary[256];
+    std::snprintf(summary, sizeof(summary), "line %llu of %llu-%llu | %.1f/%.0f MiB | priority <= %d | ",
+      static_cast<unsigned long long>(bottom),
+      static_cast<unsigned long long>(store.begin_line()),
+      static_cast<unsigned long long>(store.end_line() - 1),
+      store.memory_used() / 1048576.0,
+      store.memory_limit() / 1048576.0,
+      filter.max_priority);
+    status = summary;
+    if (filter.host != scrollback_store::filter::any_host)
+      status += "host " + store.host_name(static_cast<uint16_t>(filter.host)).to_string() + " | ";
+    status += message.empty() ? "q live, / search, r regex, n/N next/previous, 0-7/a priority, h host, t time" : message;
+  }
+
+  wattron(window, A_REVERSE);
+  mvwaddnstr(window, row - 1, 0, status.c_str(), static_cast<int>(std::min<size_t>(status.size(), col)));
+  wclrtoeol(window);
+  wattroff(window, A_REVERSE);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "scrollback_store.h"
+
+typedef struct _win_st WINDOW;
+
+// Lets the user page through and search the scrollback while new entries
+// keep arriving.
+//
+// Paging up or starting a search opens a window over the whole screen. The
+// live screen is still updated in memory below it and shown again once the
+// window is closed. Searches run in steps posted to io_service, so entries
+// are still read during long searches.
+class scrollback_view
+{
+  enum class prompt_type
+  {
+    none,
+    substring,
+    regex,
+    host,
+    time
+  };
+
+  boost::asio::io_service& io_service;
+  const scrollback_store& store;
+  boost::asio::posix::stream_descriptor input;
+  WINDOW* window = nullptr;
+  int row, col;
+
+  // Line shown at the bottom of the window.
+  uint64_t bottom = 0;
+  uint64_t highlighted = UINT64_MAX;
+  scrollback_store::filter filter;
+  // Lines shown by draw(), bottom up, and the bottom and filter they were
+  // found for.
+  std::vector<uint64_t> page;
+  uint64_t page_bottom = UINT64_MAX;
+  scrollback_store::filter page_filter;
+
+  prompt_type prompt = prompt_type::none;
+  std::string prompt_text;
+  std::string message;
+
+  std::string search_text;
+  std::regex search_regex;
+  bool search_is_regex = false;
+  bool search_backwards = true;
+  uint64_t search_position = 0;
+  // Incremented to abandon a running search.
+  unsigned search_generation = 0;
+
+  void wait_for_input();
+  void handle_input(const boost::system::error_code& ec);
+  void handle_key(int key);
+  void handle_prompt_key(int key);
+  void submit_prompt();
+
+  void open();
+  void close();
+  void scroll_by(long lines);
+  void move_to(uint64_t line);
+
+  bool matches(const scrollback_store::line& line) const;
+  void start_search(bool backwards);
+  void search_step(unsigned generation);
+
+  void draw();
+  void draw_status();
+
+public:
+  scrollback_view(boost::asio::io_service& io_service, const scrollback_store& store);
+  ~scrollback_view();
+
+  bool active() const
+  {
+    return window != nullptr;
+  }
+
+  // Called once per frame while active, to show the latest state.
+  void update();
+};
@@ -0,0 +1,173 @@
+#include "stream_outputter.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <boost/bind.hpp>
+
+#include <systemd/sd-journal.h>
+
+#include "line_format.h"
+
+namespace
+{
+const size_t block_size = 64 * 1024;
+const size_t flush_threshold = 1024 * 1024;
+const boost::posix_time::time_duration flush_interval = boost::posix_time::milliseconds(100);
+}
+
+stream_outputter::stream_outputter(boost::asio::io_service& io_service, const std::string& path, format output_format)
+  : io_service(io_service)
+  , output_format(output_format)
+  , fd(STDOUT_FILENO)
+  , owns_fd(false)
+  , flush_timer(io_service)
+  , blocks(flush_threshold / block_size + 1)
+{
+  if (path != "-")
+  {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+      throw std::system_error(errno, std::system_category(), "Failed to open '" + path + "'");
+    }
+    owns_fd = true;
+  }
+
+  for (auto&& block : blocks)
+  {
+    block.reserve(block_size);
+  }
+}
+
+stream_outputter::~stream_outputter()
+{
+  flush();
+
+  if (owns_fd)
+  {
+    close(fd);
+  }
+}
+
+void stream_outputter::add_line(const journal_entry& entry)
+{
+  std::string& block = blocks[current_block];
+  const size_t size_before = block.size();
+
+  if (output_format == format::json)
+  {
+    format_json(entry, block);
+  }
+  else
+  {
+    format_line(entry, block);
+    append_repeats(entry, block);
+  }
+  block += '\n';
+
+  buffered += block.size() - size_before;
+
+  if (buffered >= flush_threshold)
+  {
+    flush();
+    return;
+  }
+
+  if (block.size() >= block_size)
+  {
+    ++current_block;
+  }
+
+  if (!flush_scheduled)
+  {
+    flush_scheduled = true;
+    flush_timer.expires_from_now(flush_interval);
+    flush_timer.async_wait(boost::bind(&stream_outputter::on_flush_timer, this, _1));
+  }
+}
+
+void stream_outputter::format_json(const journal_entry& entry, std::string& out)
+{
+  bool first = true;
+
+  out += '{';
+  entry.for_each([&](boost::string_view name, boost::string_view value) {
+    if (!first)
+      out += ',';
+    first = false;
+
+    append_json_string(out, name);
+    out += ':';
+    append_json_value(out, value);
+  });
+  if (entry.repeats() > 1)
+  {
+    out += ",\"__REPEATS\":";
+    out += std::to_string(entry.repeats());
+  }
+  out += '}';
+}
+
+void stream_outputter::on_flush_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  flush_scheduled = false;
+  flush();
+}
+
+void stream_outputter::flush()
+{
+  std::vector<iovec> iov;
+  for (size_t i = 0; i <= current_block && i < blocks.size(); ++i)
+  {
+    if (!blocks[i].empty())
+      iov.push_back(iovec{&blocks[i][0], blocks[i].size()});
+  }
+
+  size_t first = 0;
+  while (!write_failed && first < iov.size())
+  {
+    const int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+    const ssize_t written = writev(fd, &iov[first], count);
+
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      sd_journal_print(LOG_ERR, "Error writing entries: %s", strerror(errno));
+      // The reader of the output is gone, stop like for a signal.
+      write_failed = true;
+      io_service.stop();
+      break;
+    }
+
+    size_t remaining = written;
+    while (first < iov.size() && remaining >= iov[first].iov_len)
+    {
+      remaining -= iov[first].iov_len;
+      ++first;
+    }
+    if (remaining > 0)
+    {
+      iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + remaining;
+      iov[first].iov_len -= remaining;
+    }
+  }
+
+  for (auto&& block : blocks)
+  {
+    block.clear();
+  }
+  current_block = 0;
+  buffered = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "entry_sink.h"
+
+// Writes the entries to a file or stdout, for use in pipelines.
+//
+// Lines are collected in large blocks which are written together with
+// writev() once enough data is buffered or flush_interval has passed, so no
+// system call is made per line.
+class stream_outputter : public entry_sink
+{
+public:
+  enum class format
+  {
+    // Lines as shown on the screen.
+    text,
+    // One JSON object with all read fields per line.
+    json
+  };
+
+private:
+  boost::asio::io_service& io_service;
+  const format output_format;
+  int fd;
+  bool owns_fd;
+  boost::asio::deadline_timer flush_timer;
+  bool flush_scheduled = false;
+  std::vector<std::string> blocks;
+  size_t current_block = 0;
+  size_t buffered = 0;
+  bool write_failed = false;
+
+  void format_json(const journal_entry& entry, std::string& out);
+  void on_flush_timer(const boost::system::error_code& ec);
+
+public:
+  // Writes to stdout if path is "-". Throws std::system_error if the file
+  // cannot be opened.
+  stream_outputter(boost::asio::io_service& io_service, const std::string& path, format output_format);
+  ~stream_outputter();
+
+  void add_line(const journal_entry& entry) override;
+  void flush() override;
+};
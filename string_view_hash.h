@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+#include <boost/utility/string_view.hpp>
+
+// Hash for unordered containers keyed by string views into storage which
+// does not move, so lookups need no std::string.
+struct string_view_hash
+{
+  size_t operator()(boost::string_view value) const
+  {
+    // FNV-1a
+    size_t hash = 14695981039346656037ull;
+    for (char c : value)
+    {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+};
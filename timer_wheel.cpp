@@ -0,0 +1,49 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+timer_wheel::timer_wheel(boost::asio::io_service& io_service, boost::posix_time::time_duration tick, boost::posix_time::time_duration max_delay, std::function<void()> expired)
+  : timer(io_service)
+  , tick(tick)
+  , slots(max_delay.total_microseconds() / tick.total_microseconds() + 2)
+  , expired(std::move(expired))
+{
+}
+
+void timer_wheel::schedule(boost::posix_time::time_duration delay)
+{
+  if (pending == 0)
+  {
+    timer.expires_from_now(tick);
+    timer.async_wait(boost::bind(&timer_wheel::on_tick, this, _1));
+  }
+
+  // The current slot expires within one tick, so rounding up expires no
+  // earlier than delay.
+  const int64_t tick_us = tick.total_microseconds();
+  const size_t ticks = std::min<size_t>((delay.total_microseconds() + tick_us - 1) / tick_us, slots.size() - 1);
+  ++slots[(current + ticks) % slots.size()];
+  ++pending;
+}
+
+void timer_wheel::on_tick(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  size_t count = slots[current];
+  slots[current] = 0;
+  current = (current + 1) % slots.size();
+  pending -= count;
+
+  if (pending > 0)
+  {
+    timer.expires_at(timer.expires_at() + tick);
+    timer.async_wait(boost::bind(&timer_wheel::on_tick, this, _1));
+  }
+
+  for (; count > 0; --count)
+    expired();
+}
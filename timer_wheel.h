@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+// Coarse timeouts for any number of events with a single asio timer.
+//
+// Time is split into ticks and each slot of the wheel counts the timeouts
+// expiring in its tick, so scheduling a timeout costs O(1) and no memory
+// beyond the fixed number of slots. Timeouts expire in the order they were
+// scheduled, up to one tick late. The timer only runs while timeouts are
+// pending.
+class timer_wheel
+{
+  boost::asio::deadline_timer timer;
+  const boost::posix_time::time_duration tick;
+  std::vector<size_t> slots;
+  // The slot expiring with the next tick.
+  size_t current = 0;
+  size_t pending = 0;
+  std::function<void()> expired;
+
+  void on_tick(const boost::system::error_code& ec);
+
+public:
+  // Timeouts may be up to max_delay long. expired is called once for each
+  // timeout.
+  timer_wheel(boost::asio::io_service& io_service, boost::posix_time::time_duration tick, boost::posix_time::time_duration max_delay, std::function<void()> expired);
+
+  void schedule(boost::posix_time::time_duration delay);
+
+  // Number of timeouts which did not expire yet.
+  size_t size() const
+  {
+    return pending;
+  }
+};
@@ -0,0 +1,91 @@
+#include "timestamp_formatter.h"
+
+#include <time.h>
+
+namespace
+{
+const int64_t seconds_per_hour = 3600;
+const int64_t seconds_per_day = 24 * seconds_per_hour;
+
+void put_two_digits(char* out, int value)
+{
+  out[0] = static_cast<char>('0' + value / 10);
+  out[1] = static_cast<char>('0' + value % 10);
+}
+}
+
+timestamp_formatter::timestamp_formatter()
+{
+  // localtime_r() is not required to read TZ itself.
+  tzset();
+}
+
+bool timestamp_formatter::parse(boost::string_view value, uint64_t& usec)
+{
+  // 19 digits always fit into 64 bits.
+  if (value.empty() || value.size() > 19)
+    return false;
+
+  uint64_t result = 0;
+  for (char c : value)
+  {
+    if (c < '0' || c > '9')
+      return false;
+    result = result * 10 + static_cast<uint64_t>(c - '0');
+  }
+  usec = result;
+  return true;
+}
+
+long timestamp_formatter::utc_offset(std::time_t time) const
+{
+  std::tm local;
+  if (localtime_r(&time, &local) == nullptr)
+    return 0;
+  return local.tm_gmtoff;
+}
+
+void timestamp_formatter::update_offset(int64_t second)
+{
+  const int64_t hour = second / seconds_per_hour;
+  const std::time_t begin = static_cast<std::time_t>(hour * seconds_per_hour);
+  const long begin_offset = utc_offset(begin);
+
+  // Offsets change at most a few times a year, but not necessarily at full
+  // hours. Only cache the hour if the offset is the same at both ends.
+  if (begin_offset == utc_offset(begin + seconds_per_hour - 1))
+  {
+    offset_hour = hour;
+    offset = begin_offset;
+  }
+  else
+  {
+    offset_hour = -1;
+    offset = utc_offset(static_cast<std::time_t>(second));
+  }
+}
+
+void timestamp_formatter::append(uint64_t usec, std::string& out)
+{
+  const int64_t second = static_cast<int64_t>(usec / 1000000);
+
+  if (second != cached_second)
+  {
+    if (second / seconds_per_hour != offset_hour)
+      update_offset(second);
+
+    int64_t local = (second + offset) % seconds_per_day;
+    if (local < 0)
+      local += seconds_per_day;
+
+    const int seconds_of_day = static_cast<int>(local);
+    put_two_digits(cached_text, seconds_of_day / 3600);
+    cached_text[2] = ':';
+    put_two_digits(cached_text + 3, seconds_of_day / 60 % 60);
+    cached_text[5] = ':';
+    put_two_digits(cached_text + 6, seconds_of_day % 60);
+    cached_second = second;
+  }
+
+  out.append(cached_text, sizeof(cached_text));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+#include <boost/utility/string_view.hpp>
+
+// Formats journal timestamps as local "HH:MM:SS" without allocating.
+//
+// The UTC offset is looked up once per hour and the rendered text is reused
+// while the second has not changed, which is the common case when many
+// entries arrive at once. Not thread safe, use one instance per thread.
+class timestamp_formatter
+{
+  // Hour for which offset is valid, -1 if none.
+  int64_t offset_hour = -1;
+  long offset = 0;
+  int64_t cached_second = -1;
+  char cached_text[8];
+
+  long utc_offset(std::time_t time) const;
+  void update_offset(int64_t second);
+
+public:
+  timestamp_formatter();
+
+  // Parses a decimal __REALTIME_TIMESTAMP. Returns false if it is not one.
+  static bool parse(boost::string_view value, uint64_t& usec);
+
+  // Appends the local time of the given microseconds since the epoch.
+  void append(uint64_t usec, std::string& out);
+};
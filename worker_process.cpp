@@ -0,0 +1,285 @@
+#include "worker_process.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/bind.hpp>
+
+#include <systemd/sd-journal.h>
+
+#include "entry_record.h"
+
+namespace
+{
+const size_t read_size = 256 * 1024;
+// Larger records can only come from a broken worker.
+const size_t max_record_size = 256 * 1024 * 1024;
+
+const boost::posix_time::time_duration min_restart_delay = boost::posix_time::seconds(1);
+const boost::posix_time::time_duration max_restart_delay = boost::posix_time::seconds(60);
+
+const boost::posix_time::time_duration kill_delay = boost::posix_time::seconds(5);
+const boost::posix_time::time_duration reap_interval = boost::posix_time::milliseconds(100);
+
+// Returns true once the process has exited and is reaped.
+bool reaped(pid_t pid)
+{
+  int status;
+  pid_t result;
+  while ((result = waitpid(pid, &status, WNOHANG)) < 0 && errno == EINTR)
+    ;
+  return result != 0;
+}
+}
+
+worker_process::worker_process(boost::asio::io_service& io_service, const std::vector<std::string>& arguments, const std::vector<uint32_t>& source_ids, const std::vector<metrics::source*>& stats, entry_sink& next)
+  : io_service(io_service)
+  , arguments(arguments)
+  , source_ids(source_ids)
+  , stats(stats)
+  , next(next)
+  , socket(io_service)
+  , restart_timer(io_service)
+  , restart_delay(min_restart_delay)
+  , reap_timer(io_service)
+  , buffer(read_size)
+{
+  start();
+}
+
+worker_process::~worker_process()
+{
+  stop();
+
+  boost::system::error_code ec;
+  reap_timer.cancel(ec);
+
+  // The program is ending, so waiting a little is fine, but not for a
+  // worker which hangs.
+  for (int i = 0; i < 100 && !exiting.empty(); ++i)
+  {
+    usleep(10000);
+    exiting.erase(std::remove_if(exiting.begin(), exiting.end(), [](const exiting_worker& w) { return reaped(w.pid); }), exiting.end());
+  }
+
+  for (auto&& w : exiting)
+  {
+    kill(w.pid, SIGKILL);
+    int status;
+    while (waitpid(w.pid, &status, 0) < 0 && errno == EINTR)
+      ;
+  }
+}
+
+void worker_process::start()
+{
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+  {
+    sd_journal_print(LOG_ERR, "Error creating socket for worker: %s", strerror(errno));
+    failed();
+    return;
+  }
+
+  // Everything the child needs is prepared up front, between fork and exec
+  // it may only make async-signal-safe calls.
+  const std::string fd_argument = std::to_string(fds[1]);
+  std::vector<char*> argv;
+  for (auto&& argument : arguments)
+    argv.push_back(const_cast<char*>(argument.c_str()));
+  argv.push_back(const_cast<char*>("--worker-fd"));
+  argv.push_back(const_cast<char*>(fd_argument.c_str()));
+  argv.push_back(nullptr);
+
+  pid = fork();
+  if (pid == 0)
+  {
+    // The worker must not draw over the display.
+    const int null = open("/dev/null", O_RDWR);
+    if (null >= 0)
+    {
+      dup2(null, STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      // It reports through the journal.
+      dup2(null, STDERR_FILENO);
+    }
+    fcntl(fds[1], F_SETFD, 0);
+    execv("/proc/self/exe", argv.data());
+    _exit(127);
+  }
+
+  close(fds[1]);
+  if (pid < 0)
+  {
+    sd_journal_print(LOG_ERR, "Error starting worker: %s", strerror(errno));
+    close(fds[0]);
+    failed();
+    return;
+  }
+
+  socket.assign(boost::asio::local::stream_protocol(), fds[0]);
+  started = boost::posix_time::microsec_clock::universal_time();
+  used = 0;
+  read();
+}
+
+void worker_process::read()
+{
+  if (buffer.size() - used < read_size / 2)
+    buffer.resize(std::max(buffer.size() * 2, used + read_size));
+
+  socket.async_read_some(boost::asio::buffer(buffer.data() + used, buffer.size() - used), boost::bind(&worker_process::on_read, this, _1, _2));
+}
+
+void worker_process::on_read(const boost::system::error_code& ec, size_t size)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  if (ec)
+  {
+    if (ec != boost::asio::error::eof)
+      sd_journal_print(LOG_ERR, "Error receiving entries from worker %d: %s", static_cast<int>(pid), ec.message().c_str());
+    failed();
+    return;
+  }
+
+  used += size;
+  if (!pass_on())
+  {
+    sd_journal_print(LOG_ERR, "Worker %d sent a malformed entry", static_cast<int>(pid));
+    failed();
+    return;
+  }
+
+  read();
+}
+
+bool worker_process::pass_on()
+{
+  size_t pos = 0;
+  metrics::source* last = nullptr;
+  uint64_t last_timestamp = 0;
+
+  while (used - pos >= entry_record_header_size)
+  {
+    const uint32_t size = entry_record_size(buffer.data() + pos);
+    if (size < entry_record_header_size || size > max_record_size)
+      return false;
+    if (used - pos < size)
+    {
+      if (size > buffer.size())
+        buffer.resize(size);
+      break;
+    }
+
+    if (!read_entry_record(buffer.data() + pos, size, entry) || entry.source() >= source_ids.size())
+      return false;
+
+    metrics::source* s = stats[entry.source()];
+    s->entries.add(1);
+    s->bytes.add(size);
+    // Recording the arrival of each entry would cost more than parsing it.
+    if (last != nullptr && last != s)
+      last->received(last_timestamp);
+    last = s;
+    last_timestamp = entry_record_usec(buffer.data() + pos);
+
+    entry.set_source(source_ids[entry.source()]);
+    next.add_line(entry);
+    pos += size;
+  }
+
+  if (last != nullptr)
+    last->received(last_timestamp);
+
+  // Keep the partial record for the next read.
+  std::memmove(buffer.data(), buffer.data() + pos, used - pos);
+  used -= pos;
+  return true;
+}
+
+void worker_process::stop()
+{
+  boost::system::error_code ec;
+  socket.close(ec);
+  restart_timer.cancel(ec);
+
+  if (pid <= 0)
+    return;
+
+  kill(pid, SIGTERM);
+  exiting.push_back(exiting_worker{pid, boost::posix_time::microsec_clock::universal_time() + kill_delay, false});
+  pid = -1;
+  reap();
+}
+
+void worker_process::reap()
+{
+  const auto now = boost::posix_time::microsec_clock::universal_time();
+  for (auto w = exiting.begin(); w != exiting.end();)
+  {
+    if (reaped(w->pid))
+    {
+      w = exiting.erase(w);
+      continue;
+    }
+
+    if (!w->killed && now >= w->kill_time)
+    {
+      sd_journal_print(LOG_WARNING, "Worker %d does not exit, killing it", static_cast<int>(w->pid));
+      kill(w->pid, SIGKILL);
+      w->killed = true;
+    }
+    ++w;
+  }
+
+  if (!exiting.empty() && !reap_scheduled)
+  {
+    reap_scheduled = true;
+    reap_timer.expires_from_now(reap_interval);
+    reap_timer.async_wait(boost::bind(&worker_process::on_reap_timer, this, _1));
+  }
+}
+
+void worker_process::on_reap_timer(const boost::system::error_code& ec)
+{
+  reap_scheduled = false;
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  reap();
+}
+
+void worker_process::failed()
+{
+  const pid_t failed_pid = pid;
+  stop();
+
+  // A worker which ran for a while gets a fresh start, one which keeps
+  // failing right away is retried less often.
+  const auto now = boost::posix_time::microsec_clock::universal_time();
+  if (!started.is_not_a_date_time() && now - started >= max_restart_delay)
+    restart_delay = min_restart_delay;
+
+  if (failed_pid > 0)
+    sd_journal_print(LOG_WARNING, "Worker %d stopped, starting it again in %ld s", static_cast<int>(failed_pid), static_cast<long>(restart_delay.total_seconds()));
+
+  restart_timer.expires_from_now(restart_delay);
+  restart_timer.async_wait(boost::bind(&worker_process::on_restart_timer, this, _1));
+  restart_delay = std::min(restart_delay * 2, max_restart_delay);
+}
+
+void worker_process::on_restart_timer(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  start();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "entry_sink.h"
+#include "metrics.h"
+
+// Runs a worker process and passes the entries it sends on.
+//
+// The worker is started with arguments and "--worker-fd <fd>" appended, fd
+// being its end of a Unix socket pair it writes entry records to (see
+// worker_sink). The worker numbers its sources itself; source_ids maps them
+// to the ids of this process and stats holds their metrics, in the same
+// order.
+//
+// A worker which exits or sends garbage is killed and started again after a
+// delay, which doubles while it keeps failing soon after being started. The
+// entries of the other workers keep arriving in the meantime. Stopped
+// workers are reaped by polling, so one which hangs while shutting down does
+// not hold up the display; it gets SIGKILL after a few seconds.
+class worker_process
+{
+  // A stopped worker which has not exited yet.
+  struct exiting_worker
+  {
+    pid_t pid;
+    // When it gets SIGKILL instead of time to shut down.
+    boost::posix_time::ptime kill_time;
+    bool killed;
+  };
+
+  boost::asio::io_service& io_service;
+  const std::vector<std::string> arguments;
+  const std::vector<uint32_t> source_ids;
+  const std::vector<metrics::source*> stats;
+  entry_sink& next;
+  boost::asio::local::stream_protocol::socket socket;
+  boost::asio::deadline_timer restart_timer;
+  boost::posix_time::time_duration restart_delay;
+  boost::posix_time::ptime started;
+  pid_t pid = -1;
+  std::vector<exiting_worker> exiting;
+  boost::asio::deadline_timer reap_timer;
+  bool reap_scheduled = false;
+  std::vector<char> buffer;
+  size_t used = 0;
+  journal_entry entry;
+
+  void start();
+  void read();
+  void on_read(const boost::system::error_code& ec, size_t size);
+  bool pass_on();
+  void stop();
+  void reap();
+  void on_reap_timer(const boost::system::error_code& ec);
+  void failed();
+  void on_restart_timer(const boost::system::error_code& ec);
+
+public:
+  worker_process(boost::asio::io_service& io_service, const std::vector<std::string>& arguments, const std::vector<uint32_t>& source_ids, const std::vector<metrics::source*>& stats, entry_sink& next);
+  ~worker_process();
+};
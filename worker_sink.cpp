@@ -0,0 +1,73 @@
+#include "worker_sink.h"
+
+#include <signal.h>
+#include <sys/prctl.h>
+
+#include <boost/bind.hpp>
+
+#include <systemd/sd-journal.h>
+
+#include "entry_record.h"
+
+namespace
+{
+const size_t flush_size = 64 * 1024;
+const boost::posix_time::time_duration flush_interval = boost::posix_time::milliseconds(10);
+}
+
+worker_sink::worker_sink(boost::asio::io_service& io_service, int fd)
+  : io_service(io_service)
+  , socket(io_service, boost::asio::local::stream_protocol(), fd)
+  , flush_timer(io_service)
+{
+  // An idle worker would not notice otherwise that the display process died.
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  buffer.reserve(flush_size * 2);
+}
+
+worker_sink::~worker_sink()
+{
+  flush();
+}
+
+void worker_sink::add_line(const journal_entry& entry)
+{
+  append_entry_record(entry, buffer);
+
+  if (buffer.size() >= flush_size)
+  {
+    flush();
+  }
+  else if (!flush_scheduled)
+  {
+    flush_scheduled = true;
+    flush_timer.expires_from_now(flush_interval);
+    flush_timer.async_wait(boost::bind(&worker_sink::on_flush_timer, this, _1));
+  }
+}
+
+void worker_sink::flush()
+{
+  if (buffer.empty() || !socket.is_open())
+    return;
+
+  boost::system::error_code ec;
+  boost::asio::write(socket, boost::asio::buffer(buffer), ec);
+  buffer.clear();
+
+  if (ec)
+  {
+    sd_journal_print(LOG_ERR, "Error passing entries to the display process: %s", ec.message().c_str());
+    socket.close(ec);
+    io_service.stop();
+  }
+}
+
+void worker_sink::on_flush_timer(const boost::system::error_code& ec)
+{
+  flush_scheduled = false;
+  if (ec == boost::asio::error::operation_aborted)
+    return;
+
+  flush();
+}
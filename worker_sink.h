@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "entry_sink.h"
+
+// Passes the entries of a worker process on to the display process.
+//
+// Entries are encoded as entry records and written to the Unix socket fd in
+// blocks, at the latest after a few milliseconds. Writing blocks, so a
+// display process which falls behind holds up the readers of the worker
+// instead of letting it buffer without bound. Once the display process is
+// gone io_service is stopped.
+class worker_sink : public entry_sink
+{
+  boost::asio::io_service& io_service;
+  boost::asio::local::stream_protocol::socket socket;
+  boost::asio::deadline_timer flush_timer;
+  bool flush_scheduled = false;
+  std::string buffer;
+
+  void on_flush_timer(const boost::system::error_code& ec);
+
+public:
+  // Takes ownership of fd.
+  worker_sink(boost::asio::io_service& io_service, int fd);
+  ~worker_sink();
+
+  void add_line(const journal_entry& entry) override;
+  void flush() override;
+};